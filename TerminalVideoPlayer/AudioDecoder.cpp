@@ -0,0 +1,170 @@
+#include "AudioDecoder.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+extern "C" {
+#include <libavutil/channel_layout.h>
+}
+
+static AVCodecContext *open_codec(const AVStream *audio_stream) {
+    const AVCodec *codec = avcodec_find_decoder(audio_stream->codecpar->codec_id);
+    if (!codec) {
+        throw std::runtime_error("Unsupported audio codec.");
+    }
+
+    AVCodecContext *codec_context = avcodec_alloc_context3(codec);
+    if (!codec_context) {
+        throw std::runtime_error("Could not allocate audio codec context.");
+    }
+
+    if (avcodec_parameters_to_context(codec_context, audio_stream->codecpar) < 0) {
+        throw std::runtime_error("Could not initialize audio codec context.");
+    }
+    // so the decoded frames have timestamps in the stream's time base
+    codec_context->pkt_timebase = audio_stream->time_base;
+
+    if (avcodec_open2(codec_context, codec, nullptr) < 0) {
+        throw std::runtime_error("Could not open audio codec.");
+    }
+    if (codec_context->sample_rate <= 0 || codec_context->ch_layout.nb_channels <= 0) {
+        throw std::runtime_error("Audio stream has no sample rate or channels.");
+    }
+    return codec_context;
+}
+
+AudioDecoder::AudioDecoder(AVFormatContext *format_context, int stream_index, bool preloaded, double origin_seconds)
+    : stream_index {stream_index},
+    time_base {format_context->streams[stream_index]->time_base},
+    origin_seconds {origin_seconds},
+    codec_context {open_codec(format_context->streams[stream_index])},
+    stream {static_cast<ma_uint32>(codec_context->ch_layout.nb_channels), static_cast<ma_uint32>(codec_context->sample_rate), preloaded} {
+    frame = av_frame_alloc();
+    if (!frame) {
+        throw std::runtime_error("Could not allocate audio frame.");
+    }
+}
+
+AudioDecoder::~AudioDecoder() {
+    av_frame_free(&frame);
+    swr_free(&resampler);
+    avcodec_free_context(&codec_context);
+}
+
+void AudioDecoder::decode_packet(const AVPacket *packet) {
+    // a corrupt packet only costs a moment of silence
+    if (avcodec_send_packet(codec_context, packet) < 0 && packet)
+        return;
+
+    while (avcodec_receive_frame(codec_context, frame) == 0) {
+        write_frame();
+        av_frame_unref(frame);
+    }
+}
+
+void AudioDecoder::flush(double start_seconds) {
+    avcodec_flush_buffers(codec_context);
+    // the resampler may hold samples from before the seek
+    swr_free(&resampler);
+    this->start_seconds = start_seconds;
+    segment_started = false;
+}
+
+void AudioDecoder::preload(const std::string &file_path) {
+    AVFormatContext *format_context = nullptr;
+    if (avformat_open_input(&format_context, file_path.c_str(), nullptr, nullptr) != 0) {
+        throw std::runtime_error("Could not open the video file to preload its audio.");
+    }
+
+    if (avformat_find_stream_info(format_context, nullptr) < 0 || stream_index >= (int)format_context->nb_streams) {
+        avformat_close_input(&format_context);
+        throw std::runtime_error("Could not find the audio stream to preload.");
+    }
+
+    for (unsigned int i = 0; i < format_context->nb_streams; i++) {
+        if ((int)i != stream_index)
+            format_context->streams[i]->discard = AVDISCARD_ALL;
+    }
+
+    if (format_context->duration != AV_NOPTS_VALUE)
+        stream.reserve(av_rescale(format_context->duration, stream.get_sample_rate(), AV_TIME_BASE) + stream.get_sample_rate());
+
+    AVPacket *packet = av_packet_alloc();
+    if (!packet) {
+        avformat_close_input(&format_context);
+        throw std::runtime_error("Could not allocate packet.");
+    }
+
+    while (av_read_frame(format_context, packet) >= 0) {
+        if (packet->stream_index == stream_index)
+            decode_packet(packet);
+        av_packet_unref(packet);
+    }
+    decode_packet(nullptr);
+
+    av_packet_free(&packet);
+    avformat_close_input(&format_context);
+    stream.finish_preload();
+}
+
+void AudioDecoder::configure_resampler() {
+    swr_free(&resampler);
+
+    // miniaudio gets the format the stream was opened with, even if the decoder changes its mind later
+    AVChannelLayout output_layout;
+    av_channel_layout_default(&output_layout, stream.get_channels());
+    int result = swr_alloc_set_opts2(
+        &resampler,
+        &output_layout, AV_SAMPLE_FMT_FLT, stream.get_sample_rate(),
+        &frame->ch_layout, static_cast<AVSampleFormat>(frame->format), frame->sample_rate,
+        0, nullptr);
+    if (result < 0 || swr_init(resampler) < 0) {
+        throw std::runtime_error("Could not initialize audio resampler.");
+    }
+
+    resampler_format = frame->format;
+    resampler_sample_rate = frame->sample_rate;
+    resampler_channels = frame->ch_layout.nb_channels;
+}
+
+void AudioDecoder::write_frame() {
+    if (!resampler || frame->format != resampler_format || frame->sample_rate != resampler_sample_rate || frame->ch_layout.nb_channels != resampler_channels)
+        configure_resampler();
+
+    ma_uint32 channels = stream.get_channels();
+    int max_samples = swr_get_out_samples(resampler, frame->nb_samples);
+    if (max_samples <= 0)
+        return;
+    if (converted.size() < static_cast<size_t>(max_samples) * channels)
+        converted.resize(static_cast<size_t>(max_samples) * channels);
+
+    auto *output = reinterpret_cast<uint8_t *>(converted.data());
+    int samples = swr_convert(resampler, &output, max_samples, const_cast<const uint8_t **>(frame->extended_data), frame->nb_samples);
+    if (samples <= 0)
+        return;
+
+    double sample_rate = stream.get_sample_rate();
+    double frame_start = frame->best_effort_timestamp != AV_NOPTS_VALUE
+        ? frame->best_effort_timestamp * av_q2d(time_base) - origin_seconds
+        : next_frame / sample_rate;
+    long long frame_start_sample = std::llround(frame_start * sample_rate);
+    next_frame = std::max(frame_start_sample + samples, 0ll);
+
+    // samples before the seek target, or before the start of the video (encoder priming) are never played
+    double keep_from = std::max(start_seconds, 0.0);
+    int skip = 0;
+    if (frame_start < keep_from)
+        skip = static_cast<int>(std::min<double>(samples, std::ceil((keep_from - frame_start) * sample_rate)));
+    if (skip == samples)
+        return;
+
+    if (!segment_started) {
+        stream.start_segment(std::max(frame_start_sample + skip, 0ll));
+        segment_started = true;
+    }
+    auto count = static_cast<ma_uint32>(samples - skip);
+    // the ring buffer only fills up if the audio device stopped reading,
+    // so the next frame starts a new segment at its own timestamp instead of playing late
+    if (stream.write(converted.data() + static_cast<size_t>(skip) * channels, count) < count)
+        segment_started = false;
+}
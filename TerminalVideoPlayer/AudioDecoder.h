@@ -0,0 +1,83 @@
+#pragma once
+#include <array>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "AudioStream.h"
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libswresample/swresample.h>
+}
+
+enum class AudioMode {
+    // preloads videos up to preload_audio_max_seconds long and streams longer ones
+    Auto,
+    // decodes as the video plays, only a few seconds are ever held in memory
+    Stream,
+    // decodes the whole soundtrack before playback starts
+    Preload
+};
+
+// names used on the command line
+constexpr std::array<std::pair<std::string_view, AudioMode>, 3> audio_modes {{
+    {"auto", AudioMode::Auto},
+    {"stream", AudioMode::Stream},
+    {"preload", AudioMode::Preload},
+}};
+
+// decodes the audio packets the VideoDecoder reads anyway, so the file is only demuxed once,
+// and converts them to interleaved floats for the AudioStream
+class AudioDecoder {
+public:
+    // a preloaded decoder doesn't get any packets from the video, call preload() instead
+    // origin_seconds is the video's start time, the sound is placed relative to it so both share a clock
+    AudioDecoder(AVFormatContext *format_context, int stream_index, bool preloaded, double origin_seconds);
+    ~AudioDecoder();
+    AudioDecoder(const AudioDecoder &) = delete;
+    AudioDecoder &operator=(const AudioDecoder &) = delete;
+
+    // nullptr at the end of the file to get the samples the decoder is still holding
+    void decode_packet(const AVPacket *packet);
+    // called after the demuxer seeked, samples before start_seconds are thrown away
+    // pass a negative start to keep everything from wherever the demuxer landed
+    void flush(double start_seconds);
+    // decodes the whole audio stream from its own context, so the video's read position isn't touched
+    void preload(const std::string &file_path);
+
+    inline AudioStream &get_stream() {
+        return stream;
+    }
+    inline int get_stream_index() const {
+        return stream_index;
+    }
+    inline bool is_preloaded() const {
+        return stream.is_preloaded();
+    }
+
+private:
+    // (re)creates the converter whenever the decoder's output format changes
+    void configure_resampler();
+    void write_frame();
+
+    int stream_index;
+    AVRational time_base;
+    double origin_seconds;
+    AVCodecContext *codec_context = nullptr;
+    SwrContext *resampler = nullptr;
+    // what the resampler was set up for
+    int resampler_format = -1;
+    int resampler_sample_rate = 0;
+    int resampler_channels = 0;
+    AVFrame *frame = nullptr;
+    // reused for every frame, only grows
+    std::vector<float> converted;
+    AudioStream stream;
+
+    double start_seconds = -1;
+    // whether the stream knows where the samples since the last flush belong
+    bool segment_started = false;
+    // where the next frame goes if the decoder doesn't know its timestamp
+    ma_uint64 next_frame = 0;
+};
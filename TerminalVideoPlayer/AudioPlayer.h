@@ -2,56 +2,91 @@
 
 #define MINIAUDIO_IMPLEMENTATION
 #include "miniaudio.h"
+#include "AudioStream.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <stdexcept>
 
 class AudioPlayer {
 public:
-    AudioPlayer(const char *filePath, int skip_seconds) : length_in_frames {0}, sample_rate {0} {
-        ma_result result = ma_engine_init(NULL, &engine);
+    // stream is nullptr for a video without sound, then the player only keeps time
+    // period_milliseconds is how much audio the device asks for at once, 0 lets miniaudio pick (10ms)
+    // smaller periods mean less latency but more chances of the sound crackling
+    AudioPlayer(AudioStream *stream, int skip_seconds, ma_uint32 period_milliseconds = 0) : stream {stream}, sample_rate {0} {
+        if (!stream)
+            return;
+
+        ma_engine_config config = ma_engine_config_init();
+        config.periodSizeInMilliseconds = period_milliseconds;
+        ma_result result = ma_engine_init(&config, &engine);
         if (result != MA_SUCCESS) {
             throw std::runtime_error("Failed to initialize audio engine.");
         }
 
-        result = ma_sound_init_from_file(&engine, filePath, 0, NULL, NULL, &sound);
+        result = ma_sound_init_from_data_source(&engine, stream->get_data_source(), 0, NULL, &sound);
         if (result != MA_SUCCESS) {
             ma_engine_uninit(&engine);
-            throw std::runtime_error("Failed to load sound file.");
+            throw std::runtime_error("Failed to initialize sound.");
         }
 
-        result = ma_data_source_get_length_in_pcm_frames(&sound, &length_in_frames);
-        if (result != MA_SUCCESS) {
-            ma_sound_uninit(&sound);
-            ma_engine_uninit(&engine);
-            throw std::runtime_error("Failed to get sound length.");
-        }
-
-        ma_data_source* pDataSource = ma_sound_get_data_source(&sound);
+        has_sound = true;
+        sample_rate = stream->get_sample_rate();
+        seek_amount_in_frames = static_cast<ma_uint64>(sample_rate) * skip_seconds;
 
-        result = ma_data_source_get_data_format(pDataSource, NULL, NULL, &sample_rate, NULL, NULL);
-        if (result != MA_SUCCESS) {
-            ma_sound_uninit(&sound);
-            ma_engine_uninit(&engine);
-            throw std::runtime_error("Failed to get sample rate.");
+        // every period the device has queued is read from the stream before anyone hears it
+        const ma_device *device = ma_engine_get_device(&engine);
+        if (device && device->playback.internalSampleRate > 0) {
+            output_latency = static_cast<double>(device->playback.internalPeriodSizeInFrames) * device->playback.internalPeriods
+                / device->playback.internalSampleRate;
         }
-
-        float length_in_seconds = static_cast<float>(length_in_frames) / sample_rate;
-        seek_amount_in_frames = length_in_frames / length_in_seconds * skip_seconds;
     }
 
     ~AudioPlayer() {
+        if (!has_sound)
+            return;
         ma_sound_uninit(&sound);
         ma_engine_uninit(&engine);
     }
 
     void play() {
-        ma_sound_start(&sound);
+        if (has_sound) {
+            ma_sound_start(&sound);
+        } else if (!playing) {
+            played_since = std::chrono::steady_clock::now().time_since_epoch().count();
+            playing = true;
+        }
     }
 
     void pause() {
-        ma_sound_stop(&sound);
+        if (has_sound) {
+            ma_sound_stop(&sound);
+        } else if (playing) {
+            position_before_play = get_clock();
+            playing = false;
+        }
+    }
+
+    // seconds between the stream handing samples to the device and them coming out of the speakers
+    inline double get_output_latency() const {
+        return output_latency;
+    }
+
+    // seconds of the video the listener is hearing right now, what the video is timed against
+    // lock-free and cheap enough to call for every frame from any thread
+    // without sound it is the time since play() was called, from wherever seek_to put it
+    double get_clock() const {
+        if (has_sound)
+            return static_cast<double>(stream->get_cursor()) / sample_rate - output_latency;
+        if (!playing)
+            return position_before_play;
+        std::chrono::steady_clock::duration since_play {std::chrono::steady_clock::now().time_since_epoch().count() - played_since};
+        return position_before_play + std::chrono::duration<double>(since_play).count();
     }
 
     void seekForward5seconds() {
+        if (!has_sound)
+            return;
         ma_uint64 currentFrame;
         ma_sound_get_cursor_in_pcm_frames(&sound, &currentFrame);
         ma_uint64 newFrame = currentFrame + seek_amount_in_frames;
@@ -59,6 +94,8 @@ public:
     }
 
     void seekBackward5seconds() {
+        if (!has_sound)
+            return;
         ma_uint64 currentFrame;
         ma_sound_get_cursor_in_pcm_frames(&sound, &currentFrame);
         ma_uint64 newFrame = (currentFrame > seek_amount_in_frames) ? currentFrame - seek_amount_in_frames : 0;
@@ -69,16 +106,28 @@ public:
         return sample_rate;
     }
 
+    // only needed after the video seeked, a streamed sound follows the decoder by itself
     void seek_to(double seconds) {
-        ma_uint64 newFrame = seconds * static_cast<ma_uint64>(sample_rate);
-        ma_sound_seek_to_pcm_frame(&sound, newFrame);
+        if (has_sound) {
+            stream->seek(static_cast<ma_uint64>(std::max(seconds, 0.0) * sample_rate));
+        } else {
+            position_before_play = seconds;
+            played_since = std::chrono::steady_clock::now().time_since_epoch().count();
+        }
     }
 
 private:
     ma_engine engine;
     ma_sound sound;
+    AudioStream *stream;
+    bool has_sound {false};
+    double output_latency {0};
+
+    // the clock used when there is no sound, written by the keyboard and writing threads
+    std::atomic<bool> playing {false};
+    std::atomic<double> position_before_play {0};
+    std::atomic<std::chrono::steady_clock::rep> played_since {0};
 
-    ma_uint64 seek_amount_in_frames;
-    ma_uint64 length_in_frames;
+    ma_uint64 seek_amount_in_frames {0};
     ma_uint32 sample_rate;
 };
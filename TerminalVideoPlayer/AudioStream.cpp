@@ -0,0 +1,219 @@
+#include "AudioStream.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include "constants.h"
+
+const ma_data_source_vtable AudioStream::vtable {
+    AudioStream::on_read,
+    AudioStream::on_seek,
+    AudioStream::on_get_data_format,
+    AudioStream::on_get_cursor,
+    AudioStream::on_get_length,
+    nullptr, // looping doesn't make sense for a stream
+    0
+};
+
+AudioStream::AudioStream(ma_uint32 channels, ma_uint32 sample_rate, bool preloaded)
+    : channels {channels}, sample_rate {sample_rate}, preloaded {preloaded} {
+    if (!preloaded && ma_pcm_rb_init(ma_format_f32, channels, sample_rate * audio_ring_buffer_seconds, nullptr, nullptr, &ring_buffer) != MA_SUCCESS) {
+        throw std::runtime_error("Could not allocate the audio ring buffer.");
+    }
+
+    ma_data_source_config config = ma_data_source_config_init();
+    config.vtable = &vtable;
+    source.stream = this;
+    if (ma_data_source_init(&config, &source.base) != MA_SUCCESS) {
+        if (!preloaded)
+            ma_pcm_rb_uninit(&ring_buffer);
+        throw std::runtime_error("Could not initialize the audio data source.");
+    }
+}
+
+AudioStream::~AudioStream() {
+    ma_data_source_uninit(&source.base);
+    if (!preloaded)
+        ma_pcm_rb_uninit(&ring_buffer);
+}
+
+size_t AudioStream::get_memory_usage() const {
+    if (preloaded)
+        return preloaded_samples.capacity() * sizeof(float);
+    return static_cast<size_t>(ma_pcm_rb_get_subbuffer_size(const_cast<ma_pcm_rb *>(&ring_buffer))) * channels * sizeof(float);
+}
+
+void AudioStream::reserve(ma_uint64 frame_count) {
+    if (preloaded)
+        preloaded_samples.reserve(frame_count * channels);
+}
+
+void AudioStream::finish_preload() {
+    preloaded_samples.shrink_to_fit();
+}
+
+ma_uint32 AudioStream::write(const float *samples, ma_uint32 frame_count) {
+    if (preloaded) {
+        preloaded_samples.insert(preloaded_samples.end(), samples, samples + static_cast<size_t>(frame_count) * channels);
+        return frame_count;
+    }
+
+    ma_uint32 written = 0;
+    while (written < frame_count) {
+        // the free space can wrap around the end of the ring buffer, so it may take two goes
+        ma_uint32 count = frame_count - written;
+        void *buffer;
+        if (ma_pcm_rb_acquire_write(&ring_buffer, &count, &buffer) != MA_SUCCESS || count == 0)
+            break;
+        std::memcpy(buffer, samples + written * channels, count * channels * sizeof(float));
+        ma_pcm_rb_commit_write(&ring_buffer, count);
+        written += count;
+    }
+    frames_written += written;
+    return written;
+}
+
+void AudioStream::start_segment(ma_uint64 first_frame) {
+    if (preloaded) {
+        // the soundtrack is decoded in one go, so this only happens once
+        if (preloaded_samples.empty()) {
+            this->first_frame = first_frame;
+            cursor = first_frame;
+        }
+        return;
+    }
+
+    std::lock_guard lock {segment_mutex};
+    segment_pending = true;
+    segment_start_written = frames_written;
+    segment_start_cursor = first_frame;
+    cursor.store(first_frame, std::memory_order_release);
+}
+
+void AudioStream::seek(ma_uint64 frame) {
+    if (!preloaded)
+        return;
+    ma_uint64 end = first_frame + preloaded_samples.size() / channels;
+    cursor.store(std::clamp(frame, first_frame, end), std::memory_order_release);
+}
+
+void AudioStream::advance_cursor(ma_uint64 from, ma_uint64 frame_count) {
+    cursor.compare_exchange_strong(from, from + frame_count, std::memory_order_acq_rel);
+}
+
+void AudioStream::switch_segment() {
+    std::unique_lock lock {segment_mutex, std::try_to_lock};
+    if (!lock || !segment_pending)
+        return;
+
+    if (segment_start_written > frames_consumed)
+        discard(segment_start_written - frames_consumed);
+    // if the segment was noticed late, some of it has been played already
+    cursor.store(segment_start_cursor + (frames_consumed - segment_start_written), std::memory_order_release);
+    segment_pending = false;
+}
+
+void AudioStream::discard(ma_uint64 frame_count) {
+    while (frame_count > 0) {
+        auto count = static_cast<ma_uint32>(std::min<ma_uint64>(frame_count, ma_pcm_rb_available_read(&ring_buffer)));
+        if (count == 0 || ma_pcm_rb_seek_read(&ring_buffer, count) != MA_SUCCESS)
+            break;
+        frames_consumed += count;
+        frame_count -= count;
+    }
+}
+
+ma_result AudioStream::read_preloaded(float *output, ma_uint64 frame_count) {
+    ma_uint64 total = preloaded_samples.size() / channels;
+    // seeks are clamped, so the cursor never goes before first_frame
+    ma_uint64 start = get_cursor();
+    ma_uint64 position = std::min(start - first_frame, total);
+    ma_uint64 read = std::min(frame_count, total - position);
+    if (output) {
+        std::memcpy(output, preloaded_samples.data() + position * channels, read * channels * sizeof(float));
+        // past the end, the sound keeps going so that a seek back can still play
+        ma_silence_pcm_frames(output + read * channels, frame_count - read, ma_format_f32, channels);
+    }
+    advance_cursor(start, read);
+    return MA_SUCCESS;
+}
+
+ma_result AudioStream::on_read(ma_data_source *data_source, void *frames_out, ma_uint64 frame_count, ma_uint64 *frames_read) {
+    AudioStream &stream = *static_cast<Source *>(data_source)->stream;
+    auto *output = static_cast<float *>(frames_out);
+    if (frames_read)
+        *frames_read = frame_count;
+    if (stream.preloaded)
+        return stream.read_preloaded(output, frame_count);
+
+    stream.switch_segment();
+    ma_uint64 start = stream.get_cursor();
+    ma_uint64 read = 0;
+    while (read < frame_count) {
+        auto count = static_cast<ma_uint32>(std::min<ma_uint64>(frame_count - read, UINT32_MAX));
+        void *buffer;
+        if (ma_pcm_rb_acquire_read(&stream.ring_buffer, &count, &buffer) != MA_SUCCESS || count == 0)
+            break;
+        if (output)
+            std::memcpy(output + read * stream.channels, buffer, count * stream.channels * sizeof(float));
+        ma_pcm_rb_commit_read(&stream.ring_buffer, count);
+        read += count;
+    }
+    stream.frames_consumed += read;
+    // if the decoder started a segment meanwhile, the cursor already points at it
+    stream.advance_cursor(start, read);
+
+    // the decoder fell behind (or there is nothing more), play silence without moving the cursor
+    // reporting fewer frames would make miniaudio think the sound ended and stop it for good
+    if (output && read < frame_count)
+        ma_silence_pcm_frames(output + read * stream.channels, frame_count - read, ma_format_f32, stream.channels);
+    return MA_SUCCESS;
+}
+
+ma_result AudioStream::on_seek(ma_data_source *data_source, ma_uint64 frame_index) {
+    AudioStream &stream = *static_cast<Source *>(data_source)->stream;
+    if (stream.preloaded) {
+        stream.seek(frame_index);
+        return MA_SUCCESS;
+    }
+
+    // seeking is done by the decoder, this can only skip ahead through what is already buffered
+    stream.switch_segment();
+
+    ma_uint64 current = stream.get_cursor();
+    if (frame_index <= current || frame_index - current > ma_pcm_rb_available_read(&stream.ring_buffer))
+        return MA_SUCCESS;
+
+    uint64_t consumed_before = stream.frames_consumed;
+    stream.discard(frame_index - current);
+    stream.advance_cursor(current, stream.frames_consumed - consumed_before);
+    return MA_SUCCESS;
+}
+
+ma_result AudioStream::on_get_data_format(ma_data_source *data_source, ma_format *format, ma_uint32 *channels, ma_uint32 *sample_rate, ma_channel *channel_map, size_t channel_map_capacity) {
+    const AudioStream &stream = *static_cast<Source *>(data_source)->stream;
+    if (format)
+        *format = ma_format_f32;
+    if (channels)
+        *channels = stream.channels;
+    if (sample_rate)
+        *sample_rate = stream.sample_rate;
+    if (channel_map)
+        ma_channel_map_init_standard(ma_standard_channel_map_default, channel_map, channel_map_capacity, stream.channels);
+    return MA_SUCCESS;
+}
+
+ma_result AudioStream::on_get_cursor(ma_data_source *data_source, ma_uint64 *cursor) {
+    *cursor = static_cast<Source *>(data_source)->stream->get_cursor();
+    return MA_SUCCESS;
+}
+
+ma_result AudioStream::on_get_length(ma_data_source *data_source, ma_uint64 *length) {
+    const AudioStream &stream = *static_cast<Source *>(data_source)->stream;
+    if (stream.preloaded) {
+        *length = stream.first_frame + stream.preloaded_samples.size() / stream.channels;
+        return MA_SUCCESS;
+    }
+    // not known until the decoder reaches the end
+    *length = 0;
+    return MA_NOT_IMPLEMENTED;
+}
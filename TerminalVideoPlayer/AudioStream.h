@@ -0,0 +1,101 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include "miniaudio.h"
+
+// decoded audio on its way from the decoder to miniaudio
+// the decoder writes interleaved float samples into a lock-free ring buffer
+// and miniaudio reads them on its own thread through a custom data source
+// a preloaded stream keeps the whole soundtrack in memory instead, which is written before playback starts
+class AudioStream {
+public:
+    AudioStream(ma_uint32 channels, ma_uint32 sample_rate, bool preloaded);
+    ~AudioStream();
+    AudioStream(const AudioStream &) = delete;
+    AudioStream &operator=(const AudioStream &) = delete;
+
+    // pass to ma_sound_init_from_data_source
+    inline ma_data_source *get_data_source() {
+        return &source.base;
+    }
+    inline ma_uint32 get_channels() const {
+        return channels;
+    }
+    inline ma_uint32 get_sample_rate() const {
+        return sample_rate;
+    }
+    inline bool is_preloaded() const {
+        return preloaded;
+    }
+    // pcm frame that is being played, only moves while there is audio to play
+    // lock-free, so the video can be timed against it from any thread
+    inline ma_uint64 get_cursor() const {
+        return cursor.load(std::memory_order_acquire);
+    }
+    // bytes of decoded audio held at once
+    size_t get_memory_usage() const;
+    // frames written to the ring buffer that the audio thread hasn't read yet, how far ahead the decoder is
+    inline ma_uint32 get_buffered_frames() {
+        return preloaded ? 0 : ma_pcm_rb_available_read(&ring_buffer);
+    }
+
+    // called by the decoder, returns how many frames fit in the ring buffer
+    // it never waits, so a stalled audio device can't hold up the video
+    ma_uint32 write(const float *samples, ma_uint32 frame_count);
+    // for preloaded streams, so the soundtrack doesn't end up in a buffer twice its size
+    void reserve(ma_uint64 frame_count);
+    void finish_preload();
+    // everything written from now on starts at first_frame,
+    // anything written before it that wasn't played yet is thrown away (after a seek)
+    // the cursor moves there right away, not only once the audio thread gets to it
+    void start_segment(ma_uint64 first_frame);
+    // moves a preloaded stream to frame, takes effect immediately from any thread
+    // a streamed one is moved by the decoder seeking instead, so this does nothing for it
+    void seek(ma_uint64 frame);
+
+private:
+    // miniaudio only knows about the data source, so it has to lead back to the stream
+    struct Source {
+        ma_data_source_base base;
+        AudioStream *stream;
+    };
+
+    static ma_result on_read(ma_data_source *data_source, void *frames_out, ma_uint64 frame_count, ma_uint64 *frames_read);
+    static ma_result on_seek(ma_data_source *data_source, ma_uint64 frame_index);
+    static ma_result on_get_data_format(ma_data_source *data_source, ma_format *format, ma_uint32 *channels, ma_uint32 *sample_rate, ma_channel *channel_map, size_t channel_map_capacity);
+    static ma_result on_get_cursor(ma_data_source *data_source, ma_uint64 *cursor);
+    static ma_result on_get_length(ma_data_source *data_source, ma_uint64 *length);
+
+    ma_result read_preloaded(float *output, ma_uint64 frame_count);
+
+    // only if nobody moved the cursor since it was read, a seek wins over the audio thread
+    void advance_cursor(ma_uint64 from, ma_uint64 frame_count);
+    // runs on the audio thread, drops a segment that was replaced by a newer one
+    void switch_segment();
+    void discard(ma_uint64 frame_count);
+
+    ma_uint32 channels;
+    ma_uint32 sample_rate;
+    bool preloaded;
+    ma_pcm_rb ring_buffer;
+    // the whole soundtrack when preloaded, preloaded_samples[0] is played at first_frame
+    std::vector<float> preloaded_samples;
+    ma_uint64 first_frame {0};
+    Source source;
+
+    static const ma_data_source_vtable vtable;
+
+    // counted from the start, so the audio thread knows where a segment begins in the ring buffer
+    // frames_written belongs to the decoder and frames_consumed to the audio thread
+    uint64_t frames_written {0};
+    uint64_t frames_consumed {0};
+    std::atomic<ma_uint64> cursor {0};
+
+    // the audio thread only ever try_locks this, so it never waits on the decoder
+    std::mutex segment_mutex;
+    bool segment_pending {false};
+    uint64_t segment_start_written {0};
+    ma_uint64 segment_start_cursor {0};
+};
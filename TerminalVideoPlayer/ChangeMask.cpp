@@ -0,0 +1,189 @@
+#include "ChangeMask.h"
+#include <algorithm>
+#include <cmath>
+#include "constants.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CHANGE_MASK_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// MSVC can always use intrinsics, gcc and clang need to be told which functions may use them
+#if defined(CHANGE_MASK_X86) && !defined(_MSC_VER)
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSE2
+#define TARGET_AVX2
+#endif
+
+// every kernel fills the mask words for one row, a multiple of 16 cells long (see screen_row_alignment)
+// bit i of the mask is set when either half of cell i is at least sqrt(min_distance_squared) away
+typedef void (*RowKernel)(const uint32_t *old_top, const uint32_t *old_bottom, const uint32_t *new_top, const uint32_t *new_bottom, size_t cells, int min_distance_squared, uint64_t *mask);
+
+#ifndef CHANGE_MASK_X86
+static void scalar_row(const uint32_t *old_top, const uint32_t *old_bottom, const uint32_t *new_top, const uint32_t *new_bottom, size_t cells, int min_distance_squared, uint64_t *mask) {
+    for (size_t word = 0; word * 64 < cells; ++word) {
+        uint64_t bits = 0;
+        for (size_t i = word * 64; i < cells && i < word * 64 + 64; ++i) {
+            bool changed = distance_squared(old_top[i], new_top[i]) >= min_distance_squared ||
+                distance_squared(old_bottom[i], new_bottom[i]) >= min_distance_squared;
+            bits |= static_cast<uint64_t>(changed) << (i % 64);
+        }
+        mask[word] = bits;
+    }
+}
+#endif
+
+#ifdef CHANGE_MASK_X86
+// the channels of a packed pixel are bytes, so |a - b| is saturated a - b or b - a,
+// splitting out the even (r, b) and odd (g, 0) bytes into 16 bit lanes lets madd square and add them in pairs
+// the largest possible sum, 3 * 255^2, fits comfortably in the 32 bit lanes
+
+TARGET_SSE2 static inline __m128i distance_squared_sse2(__m128i a, __m128i b) {
+    const __m128i low_bytes = _mm_set1_epi16(0x00FF);
+    __m128i difference = _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a));
+    __m128i even = _mm_and_si128(difference, low_bytes);
+    __m128i odd = _mm_srli_epi16(difference, 8);
+    return _mm_add_epi32(_mm_madd_epi16(even, even), _mm_madd_epi16(odd, odd));
+}
+
+// 4 bits, one per cell
+TARGET_SSE2 static inline int changed_cells_sse2(const uint32_t *old_top, const uint32_t *old_bottom, const uint32_t *new_top, const uint32_t *new_bottom, __m128i limit) {
+    __m128i top = distance_squared_sse2(_mm_load_si128(reinterpret_cast<const __m128i *>(old_top)), _mm_load_si128(reinterpret_cast<const __m128i *>(new_top)));
+    __m128i bottom = distance_squared_sse2(_mm_load_si128(reinterpret_cast<const __m128i *>(old_bottom)), _mm_load_si128(reinterpret_cast<const __m128i *>(new_bottom)));
+    __m128i changed = _mm_or_si128(_mm_cmpgt_epi32(top, limit), _mm_cmpgt_epi32(bottom, limit));
+    return _mm_movemask_ps(_mm_castsi128_ps(changed));
+}
+
+TARGET_SSE2 static void sse2_row(const uint32_t *old_top, const uint32_t *old_bottom, const uint32_t *new_top, const uint32_t *new_bottom, size_t cells, int min_distance_squared, uint64_t *mask) {
+    // cmpgt against min - 1 is the same as >= min
+    const __m128i limit = _mm_set1_epi32(min_distance_squared - 1);
+    for (size_t i = 0; i < cells; i += 16) {
+        uint64_t bits = 0;
+        for (int j = 0; j < 16; j += 4)
+            bits |= static_cast<uint64_t>(changed_cells_sse2(old_top + i + j, old_bottom + i + j, new_top + i + j, new_bottom + i + j, limit)) << j;
+        if (i % 64 == 0)
+            mask[i / 64] = bits;
+        else
+            mask[i / 64] |= bits << (i % 64);
+    }
+}
+
+TARGET_AVX2 static inline __m256i distance_squared_avx2(__m256i a, __m256i b) {
+    const __m256i low_bytes = _mm256_set1_epi16(0x00FF);
+    __m256i difference = _mm256_or_si256(_mm256_subs_epu8(a, b), _mm256_subs_epu8(b, a));
+    __m256i even = _mm256_and_si256(difference, low_bytes);
+    __m256i odd = _mm256_srli_epi16(difference, 8);
+    return _mm256_add_epi32(_mm256_madd_epi16(even, even), _mm256_madd_epi16(odd, odd));
+}
+
+// 8 bits, one per cell
+TARGET_AVX2 static inline int changed_cells_avx2(const uint32_t *old_top, const uint32_t *old_bottom, const uint32_t *new_top, const uint32_t *new_bottom, __m256i limit) {
+    __m256i top = distance_squared_avx2(_mm256_load_si256(reinterpret_cast<const __m256i *>(old_top)), _mm256_load_si256(reinterpret_cast<const __m256i *>(new_top)));
+    __m256i bottom = distance_squared_avx2(_mm256_load_si256(reinterpret_cast<const __m256i *>(old_bottom)), _mm256_load_si256(reinterpret_cast<const __m256i *>(new_bottom)));
+    __m256i changed = _mm256_or_si256(_mm256_cmpgt_epi32(top, limit), _mm256_cmpgt_epi32(bottom, limit));
+    return _mm256_movemask_ps(_mm256_castsi256_ps(changed));
+}
+
+TARGET_AVX2 static void avx2_row(const uint32_t *old_top, const uint32_t *old_bottom, const uint32_t *new_top, const uint32_t *new_bottom, size_t cells, int min_distance_squared, uint64_t *mask) {
+    const __m256i limit = _mm256_set1_epi32(min_distance_squared - 1);
+    for (size_t i = 0; i < cells; i += 16) {
+        uint64_t bits = static_cast<uint64_t>(changed_cells_avx2(old_top + i, old_bottom + i, new_top + i, new_bottom + i, limit));
+        bits |= static_cast<uint64_t>(changed_cells_avx2(old_top + i + 8, old_bottom + i + 8, new_top + i + 8, new_bottom + i + 8, limit)) << 8;
+        if (i % 64 == 0)
+            mask[i / 64] = bits;
+        else
+            mask[i / 64] |= bits << (i % 64);
+    }
+}
+
+static bool cpu_has_avx2() {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+    __cpuid(info, 1);
+    // the OS has to save the AVX registers on context switches too
+    bool os_saves_avx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+    if (!os_saves_avx)
+        return false;
+    __cpuidex(info, 7, 0);
+    return info[1] & (1 << 5);
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+// picked once, the first time a mask is computed
+static RowKernel choose_kernel() {
+#ifdef CHANGE_MASK_X86
+    if (cpu_has_avx2())
+        return avx2_row;
+    return sse2_row;
+#else
+    return scalar_row;
+#endif
+}
+
+void ChangeMask::compute(const ScreenBuffer &old_frame, const ScreenBuffer &new_frame, double threshold) {
+    static const RowKernel kernel = choose_kernel();
+
+    int rows = new_frame.get_rows();
+    int cols = new_frame.get_cols();
+    size_t stride = new_frame.get_stride();
+    words_per_row = (stride + 63) / 64;
+    if (old_frame.get_rows() != rows || old_frame.get_cols() != cols) {
+        words.assign(words_per_row * rows, 0);
+        return;
+    }
+    words.resize(words_per_row * rows);
+
+    // the distances are whole numbers, so comparing d^2 with the rounded up threshold^2 gives the same answer as d with threshold
+    // anything above the largest possible distance means nothing is ever redrawn
+    const double max_distance_squared = 3 * 255 * 255;
+    int min_distance_squared = threshold <= 0 ? 0 : static_cast<int>(std::ceil(std::min(threshold * threshold, max_distance_squared + 1)));
+    // the padding is 0 in both buffers, so it only counts as changed when every cell does
+    uint64_t last_word_mask = cols % 64 == 0 ? ~0ull : (1ull << (cols % 64)) - 1;
+    size_t last_word = cols > 0 ? (cols - 1) / 64 : 0;
+
+    for (int row = 0; row < rows; ++row) {
+        uint64_t *mask = words.data() + row * words_per_row;
+        kernel(old_frame.top_row(row), old_frame.bottom_row(row), new_frame.top_row(row), new_frame.bottom_row(row), stride, min_distance_squared, mask);
+        mask[last_word] &= last_word_mask;
+        for (size_t word = last_word + 1; word < words_per_row; ++word)
+            mask[word] = 0;
+    }
+}
+
+int ChangeMask::count_changed(int row) const {
+    const uint64_t *row_words = this->row(row);
+    int changed = 0;
+    for (size_t word = 0; word < words_per_row; ++word)
+        changed += count_set_bits(row_words[word]);
+    return changed;
+}
+
+int ChangeMask::count_runs(int row) const {
+    const uint64_t *row_words = this->row(row);
+    int runs = 0;
+    // the bit before a word is the last bit of the word before it
+    uint64_t carry = 0;
+    for (size_t word = 0; word < words_per_row; ++word) {
+        runs += count_set_bits(row_words[word] & ~((row_words[word] << 1) | carry));
+        carry = row_words[word] >> 63;
+    }
+    return runs;
+}
+
+size_t ChangeMask::count_changed() const {
+    size_t changed = 0;
+    for (uint64_t word : words)
+        changed += count_set_bits(word);
+    return changed;
+}
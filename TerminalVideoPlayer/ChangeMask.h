@@ -0,0 +1,85 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "ScreenBuffer.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// index of the lowest set bit, word can't be 0
+inline int lowest_set_bit(uint64_t word) {
+#if defined(_MSC_VER) && defined(_M_X64)
+    unsigned long index;
+    _BitScanForward64(&index, word);
+    return static_cast<int>(index);
+#elif defined(_MSC_VER)
+    unsigned long index;
+    if (_BitScanForward(&index, static_cast<uint32_t>(word)))
+        return static_cast<int>(index);
+    _BitScanForward(&index, static_cast<uint32_t>(word >> 32));
+    return static_cast<int>(index) + 32;
+#else
+    return __builtin_ctzll(word);
+#endif
+}
+
+inline int count_set_bits(uint64_t word) {
+#if defined(_MSC_VER) && defined(_M_X64)
+    return static_cast<int>(__popcnt64(word));
+#elif defined(_MSC_VER)
+    return static_cast<int>(__popcnt(static_cast<uint32_t>(word)) + __popcnt(static_cast<uint32_t>(word >> 32)));
+#else
+    return __builtin_popcountll(word);
+#endif
+}
+
+// one bit per cell, set for the cells that changed enough between two frames to be worth redrawing
+// rows are kept as 64 bit words so the renderer can skip unchanged stretches a word at a time
+class ChangeMask {
+public:
+    // marks the cells where either half of new_frame is at least threshold away (as an RGB distance)
+    // from the same half in old_frame, both buffers need the same size,
+    // if they don't nothing is marked (reading the smaller one would go out of bounds) and the frame has to be drawn whole
+    // the distances are compared squared and in integers, 16 cells at a time with SSE2 or AVX2
+    void compute(const ScreenBuffer &old_frame, const ScreenBuffer &new_frame, double threshold);
+
+    inline const uint64_t *row(int row) const {
+        return words.data() + row * words_per_row;
+    }
+    inline size_t get_words_per_row() const {
+        return words_per_row;
+    }
+    inline bool is_changed(int row, int col) const {
+        return (this->row(row)[col / 64] >> (col % 64)) & 1;
+    }
+    inline void set_changed(int row, int col, bool changed) {
+        uint64_t &word = words[row * words_per_row + col / 64];
+        word = (word & ~(1ull << (col % 64))) | (static_cast<uint64_t>(changed) << (col % 64));
+    }
+
+    // first changed cell of the row at or after col, -1 if there isn't one
+    inline int next_changed(int row, int col) const {
+        const uint64_t *row_words = this->row(row);
+        size_t word = col / 64;
+        if (word >= words_per_row)
+            return -1;
+        uint64_t bits = row_words[word] & (~0ull << (col % 64));
+        while (bits == 0) {
+            if (++word == words_per_row)
+                return -1;
+            bits = row_words[word];
+        }
+        return static_cast<int>(word * 64) + lowest_set_bit(bits);
+    }
+
+    int count_changed(int row) const;
+    // stretches of changed cells in the row, every one of them starts with a cursor move
+    int count_runs(int row) const;
+    size_t count_changed() const;
+
+private:
+    std::vector<uint64_t> words;
+    size_t words_per_row {0};
+};
@@ -0,0 +1,62 @@
+#include "CursorMotion.h"
+#include "EscapeEncoder.h"
+
+static int forward_cost(int cells) {
+    return cells == 1 ? 3 : 3 + decimal_length(cells);
+}
+
+void CursorMotion::advance(int cells) {
+    x += cells;
+    // printing into the last column leaves the cursor there with a wrap pending,
+    // terminals disagree on what happens next, so it is moved with ESC[y;xH again
+    if (x >= screen_width)
+        known = false;
+}
+
+std::pair<CursorMotion::Motion, int> CursorMotion::cheapest_motion(int x, int y) const {
+    std::pair<Motion, int> best {Motion::Absolute, 4 + decimal_length(y) + decimal_length(x + 1)};
+    if (!known)
+        return best;
+    if (is_at(x, y))
+        return {Motion::None, 0};
+
+    auto consider = [&](Motion motion, int cost) {
+        if (cost < best.second)
+            best = {motion, cost};
+    };
+    if (y == this->y) {
+        if (x > this->x)
+            consider(Motion::Forward, forward_cost(x - this->x));
+        consider(Motion::Column, x == 0 ? 3 : 3 + decimal_length(x + 1));
+    } else if (y > this->y) {
+        consider(Motion::NextLine, 1 + (y - this->y) + (x > 0 ? forward_cost(x) : 0));
+    }
+    return best;
+}
+
+int CursorMotion::cost(int x, int y) const {
+    return cheapest_motion(x, y).second;
+}
+
+void CursorMotion::move_to(int x, int y, std::string &result) {
+    switch (cheapest_motion(x, y).first) {
+    case Motion::None:
+        return;
+    case Motion::Forward:
+        append_sequence(result, max_cursor_sequence_length, [&](char *out) { return encode_cursor_forward(out, x - this->x); });
+        break;
+    case Motion::Column:
+        append_sequence(result, max_cursor_sequence_length, [&](char *out) { return encode_cursor_column(out, x); });
+        break;
+    case Motion::NextLine:
+        result.push_back('\r');
+        result.append(y - this->y, '\n');
+        if (x > 0)
+            append_sequence(result, max_cursor_sequence_length, [&](char *out) { return encode_cursor_forward(out, x); });
+        break;
+    case Motion::Absolute:
+        append_sequence(result, max_cursor_sequence_length, [&](char *out) { return encode_cursor(out, x, y); });
+        break;
+    }
+    moved_to(x, y);
+}
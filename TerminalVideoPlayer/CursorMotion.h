@@ -0,0 +1,52 @@
+#pragma once
+#include <string>
+#include <utility>
+
+// keeps track of where the terminal's cursor is and moves it with the shortest sequence that gets it there
+// columns are 0 based and rows 1 based, like set_cursor
+class CursorMotion {
+public:
+    explicit CursorMotion(int screen_width) : screen_width {screen_width} {}
+
+    // something was written that the cursor wasn't told about, it could be anywhere now
+    inline void forget() {
+        known = false;
+    }
+    // cells were printed at the cursor, which moves it right
+    void advance(int cells);
+    inline bool is_at(int x, int y) const {
+        return known && x == this->x && y == this->y;
+    }
+    // how many cells left of (x, y) the cursor is on the same row, -1 if it isn't
+    inline int cells_before(int x, int y) const {
+        return known && y == this->y && x >= this->x ? x - this->x : -1;
+    }
+    // bytes move_to(x, y) would write
+    int cost(int x, int y) const;
+    void move_to(int x, int y, std::string &result);
+    // the cursor was moved to x, y by someone else, for keeping track of it without writing anything
+    inline void moved_to(int x, int y) {
+        known = true;
+        this->x = x;
+        this->y = y;
+    }
+
+private:
+    enum class Motion {
+        None,
+        // ESC[nC
+        Forward,
+        // ESC[nG
+        Column,
+        // CR, LFs and then ESC[nC if the column isn't the first
+        NextLine,
+        // ESC[y;xH, the only one that works without knowing where the cursor is
+        Absolute
+    };
+    std::pair<Motion, int> cheapest_motion(int x, int y) const;
+
+    int screen_width;
+    bool known {false};
+    int x {0};
+    int y {0};
+};
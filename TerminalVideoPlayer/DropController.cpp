@@ -0,0 +1,53 @@
+#include "DropController.h"
+#include <algorithm>
+#include <cmath>
+#include "constants.h"
+
+int DropController::frames_to_skip(PlaybackState &state, long long next_frame) {
+    double frame_duration = 1.0 / fps;
+    // the stages run in parallel, so the slowest one sets the pace
+    double bottleneck = std::max({state.decode_cost.load(), state.scale_cost.load(), state.render_cost.load(), state.write_cost.load()});
+
+    // every queued frame takes bottleneck to get out but only moves the video on by the frames it stands for
+    double queue_delay = std::max(0.0, state.frames_in_flight * (bottleneck - frame_duration / shown_fraction));
+    double lateness = state.lateness;
+    bool lateness_is_current = state.curr_frame >= caught_up_at;
+
+    if (lateness_is_current && lateness + queue_delay > catch_up_threshold_frames * frame_duration) {
+        // too far behind to catch up by showing fewer frames
+        int skip = static_cast<int>(std::llround((lateness + queue_delay) * fps));
+        caught_up_at = next_frame + skip;
+        accumulator = 0;
+        catching_up = true;
+        return skip;
+    }
+    catching_up = false;
+
+    if (lateness_is_current) {
+        if (lateness > frame_duration / 2)
+            correction = std::max(correction * drop_correction_decrease, min_shown_fraction);
+        else if (lateness <= 0)
+            correction = std::min(correction + drop_correction_increase, 1.0);
+    }
+
+    double capacity = bottleneck > 0 ? frame_duration / (bottleneck * drop_cost_headroom) : 1.0;
+    shown_fraction = std::clamp(capacity * correction, min_shown_fraction, 1.0);
+    state.shown_fraction = shown_fraction;
+
+    // showing 0.5 of the frames means every other one, not nothing for a while and then everything
+    int skip = 0;
+    accumulator += shown_fraction;
+    while (accumulator < 1) {
+        accumulator += shown_fraction;
+        skip++;
+    }
+    accumulator -= 1;
+    return skip;
+}
+
+void DropController::reset() {
+    accumulator = 0;
+    correction = 1;
+    caught_up_at = 0;
+    catching_up = false;
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include "Pipeline.h"
+
+// decides which frames are worth decoding fully, from what the stages measured
+// the pipeline can only show frames as fast as its slowest stage, every frame waiting in a queue
+// adds to how late the next one is, and the write stage reports how late the last one actually was
+// frames that can't be kept up with are skipped evenly (every other frame rather than bursts of ten),
+// only a frame that is already far behind the sound makes it skip a whole stretch at once
+class DropController {
+public:
+    explicit DropController(double fps) : fps {fps} {}
+
+    // how many frames to skip before the next one that is shown, called by the decode stage for every shown frame
+    // next_frame is the number the decode stage would give the frame if nothing was skipped
+    int frames_to_skip(PlaybackState &state, long long next_frame);
+    // whether the last skip was a stretch to catch up with the sound rather than thinning out the frames,
+    // only then does it not matter exactly how many frames go by
+    inline bool is_catching_up() const {
+        return catching_up;
+    }
+    // the skipping that was going on before a seek doesn't say anything about after it
+    void reset();
+
+private:
+    double fps;
+    // fraction of the frames that is shown, follows the measured costs
+    double shown_fraction {1};
+    // lowered while frames come out late despite the costs saying they shouldn't, raised again when they don't
+    double correction {1};
+    // builds up by shown_fraction per frame, a frame is shown every time it reaches 1
+    double accumulator {0};
+    // frames up to here were decoded before the last catch up, their lateness is old news
+    long long caught_up_at {0};
+    bool catching_up {false};
+};
@@ -0,0 +1,152 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include "Pixel.h"
+
+// writes escape sequences straight into memory that already has room for them,
+// without a format string or any checks, the numbers come from a table instead of being divided out
+
+struct DecimalString {
+    // always copied as a whole, only the first length chars are the number
+    char chars[4];
+    uint8_t length;
+};
+
+constexpr std::array<DecimalString, 256> make_decimal_strings() {
+    std::array<DecimalString, 256> strings {};
+    for (int i = 0; i < 256; ++i) {
+        DecimalString &s = strings[i];
+        if (i >= 100) {
+            s.chars[0] = static_cast<char>('0' + i / 100);
+            s.chars[1] = static_cast<char>('0' + i / 10 % 10);
+            s.chars[2] = static_cast<char>('0' + i % 10);
+            s.length = 3;
+        } else if (i >= 10) {
+            s.chars[0] = static_cast<char>('0' + i / 10);
+            s.chars[1] = static_cast<char>('0' + i % 10);
+            s.length = 2;
+        } else {
+            s.chars[0] = static_cast<char>('0' + i);
+            s.length = 1;
+        }
+    }
+    return strings;
+}
+
+constexpr std::array<DecimalString, 256> decimal_strings = make_decimal_strings();
+
+// the longest sequences plus the slack for copying whole table entries
+// ESC[48;2;255;255;255m
+constexpr size_t max_color_sequence_length = 19 + 4;
+// ESC[48;2;255;255;255;38;2;255;255;255m
+constexpr size_t max_color_pair_sequence_length = 36 + 4;
+// ESC[65535;65535H, terminals don't get bigger than that
+constexpr size_t max_cursor_sequence_length = 14 + 4;
+
+// out needs room for 4 bytes even if the number is shorter
+inline char *encode_byte(char *out, uint8_t value) {
+    const DecimalString &s = decimal_strings[value];
+    std::memcpy(out, s.chars, sizeof(s.chars));
+    return out + s.length;
+}
+
+inline char *encode_number(char *out, unsigned value) {
+    if (value < decimal_strings.size())
+        return encode_byte(out, static_cast<uint8_t>(value));
+    char digits[10];
+    int length = 0;
+    while (value > 0) {
+        digits[length++] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    }
+    while (length > 0)
+        *out++ = digits[--length];
+    return out;
+}
+
+// 48;2;r;g;b for the background, 38;2;r;g;b for the foreground, so several can go in one sequence
+inline char *encode_color_parameters(char *out, Pixel p, bool bg) {
+    std::memcpy(out, bg ? "48;2;" : "38;2;", 5);
+    out = encode_byte(out + 5, p.r);
+    *out++ = ';';
+    out = encode_byte(out, p.g);
+    *out++ = ';';
+    return encode_byte(out, p.b);
+}
+
+// ESC[48;2;r;g;bm for the background, ESC[38;2;r;g;bm for the foreground
+inline char *encode_color(char *out, Pixel p, bool bg) {
+    *out++ = '\x1B';
+    *out++ = '[';
+    out = encode_color_parameters(out, p, bg);
+    *out++ = 'm';
+    return out;
+}
+
+// bytes encode_color writes, without the slack
+inline int color_sequence_length(Pixel p) {
+    return 10 + decimal_strings[p.r].length + decimal_strings[p.g].length + decimal_strings[p.b].length;
+}
+
+// ESC[y;xH, x is 0 based and y is 1 based like set_cursor
+inline char *encode_cursor(char *out, size_t x, size_t y) {
+    *out++ = '\x1B';
+    *out++ = '[';
+    out = encode_number(out, static_cast<unsigned>(y));
+    *out++ = ';';
+    out = encode_number(out, static_cast<unsigned>(x + 1));
+    *out++ = 'H';
+    return out;
+}
+
+// ESC[nC, the count can be left out when it is 1
+inline char *encode_cursor_forward(char *out, unsigned cells) {
+    *out++ = '\x1B';
+    *out++ = '[';
+    if (cells != 1)
+        out = encode_number(out, cells);
+    *out++ = 'C';
+    return out;
+}
+
+// ESC[nG, x is 0 based, the column can be left out when it is the first one
+inline char *encode_cursor_column(char *out, size_t x) {
+    *out++ = '\x1B';
+    *out++ = '[';
+    if (x != 0)
+        out = encode_number(out, static_cast<unsigned>(x + 1));
+    *out++ = 'G';
+    return out;
+}
+
+// ESC[nb (REP) or ESC[nX (ECH), the count can be left out when it is 1
+inline char *encode_run(char *out, unsigned count, char final_byte) {
+    *out++ = '\x1B';
+    *out++ = '[';
+    if (count != 1)
+        out = encode_number(out, count);
+    *out++ = final_byte;
+    return out;
+}
+
+constexpr int decimal_length(unsigned value) {
+    int length = 1;
+    while (value >= 10) {
+        value /= 10;
+        length++;
+    }
+    return length;
+}
+
+// makes room for the longest possible sequence, lets encode write into it and then cuts off what wasn't used
+// once the string has grown to its working size none of this allocates
+template <typename Encode>
+inline void append_sequence(std::string &result, size_t max_length, Encode encode) {
+    size_t size = result.size();
+    result.resize(size + max_length);
+    char *end = encode(&result[size]);
+    result.resize(end - result.data());
+}
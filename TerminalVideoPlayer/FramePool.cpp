@@ -0,0 +1,25 @@
+#include "FramePool.h"
+#include <stdexcept>
+
+FramePool::~FramePool() {
+    av_buffer_pool_uninit(&pool);
+}
+
+PixelBuffer FramePool::get(size_t num_bytes) {
+    if (!pool || num_bytes != buffer_size) {
+        // the old pool is only really freed once all of its buffers have been returned
+        av_buffer_pool_uninit(&pool);
+        // av_buffer_alloc uses av_malloc, which aligns the buffer for SIMD
+        pool = av_buffer_pool_init(num_bytes, av_buffer_alloc);
+        buffer_size = num_bytes;
+        if (!pool) {
+            throw std::runtime_error("Could not allocate frame buffer pool.");
+        }
+    }
+
+    AVBufferRef *ref = av_buffer_pool_get(pool);
+    if (!ref) {
+        throw std::runtime_error("Could not get a frame buffer from the pool.");
+    }
+    return PixelBuffer {ref};
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <cstddef>
+#include <utility>
+#include "Pixel.h"
+
+extern "C" {
+#include <libavutil/buffer.h>
+}
+
+// reference counted handle to a buffer that came from a FramePool
+// the buffer goes back to the pool when the last handle is reset or destroyed
+class PixelBuffer {
+public:
+    PixelBuffer() = default;
+    explicit PixelBuffer(AVBufferRef *ref) : ref {ref} {}
+    ~PixelBuffer() {
+        reset();
+    }
+    PixelBuffer(const PixelBuffer &other) : ref {other.ref ? av_buffer_ref(other.ref) : nullptr} {}
+    PixelBuffer(PixelBuffer &&other) noexcept : ref {std::exchange(other.ref, nullptr)} {}
+    PixelBuffer &operator=(PixelBuffer other) noexcept {
+        std::swap(ref, other.ref);
+        return *this;
+    }
+
+    void reset() {
+        av_buffer_unref(&ref);
+    }
+
+    inline Pixel *get() const {
+        return ref ? reinterpret_cast<Pixel *>(ref->data) : nullptr;
+    }
+    inline size_t size() const {
+        return ref ? ref->size : 0;
+    }
+    explicit operator bool() const {
+        return ref != nullptr;
+    }
+
+private:
+    AVBufferRef *ref = nullptr;
+};
+
+// hands out aligned buffers that are reused instead of being freed,
+// so once playback is going no frame needs a new heap allocation
+// all buffers have the same size, asking for a different size (the terminal was resized)
+// starts a new pool, buffers from the old one stay valid until they are released
+class FramePool {
+public:
+    FramePool() = default;
+    ~FramePool();
+    FramePool(const FramePool &) = delete;
+    FramePool &operator=(const FramePool &) = delete;
+
+    PixelBuffer get(size_t num_bytes);
+
+private:
+    AVBufferPool *pool = nullptr;
+    size_t buffer_size = 0;
+};
@@ -0,0 +1,188 @@
+#include "MappedFileIO.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include "constants.h"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define VC_EXTRALEAN
+#define NOMINMAX
+#include <Windows.h>
+#include <psapi.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static size_t get_page_size() {
+#if defined(_WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwPageSize;
+#else
+    return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+}
+
+static uint64_t count_page_faults() {
+#if defined(_WIN32)
+    // windows doesn't separate faults that went to the disk from the rest
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return counters.PageFaultCount;
+    return 0;
+#else
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+        return usage.ru_majflt;
+    return 0;
+#endif
+}
+
+std::unique_ptr<MappedFileIO> MappedFileIO::open(const std::string &file_path) {
+    // anything that fails below is cleaned up by the destructor
+    std::unique_ptr<MappedFileIO> file {new MappedFileIO};
+
+#if defined(_WIN32)
+    HANDLE file_handle = CreateFileA(file_path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file_handle == INVALID_HANDLE_VALUE)
+        return nullptr;
+    file->file_handle = file_handle;
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file_handle, &file_size) || file_size.QuadPart <= 0 || static_cast<uint64_t>(file_size.QuadPart) > SIZE_MAX)
+        return nullptr;
+
+    file->mapping_handle = CreateFileMappingA(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!file->mapping_handle)
+        return nullptr;
+
+    file->data = static_cast<const uint8_t *>(MapViewOfFile(file->mapping_handle, FILE_MAP_READ, 0, 0, 0));
+    if (!file->data)
+        return nullptr;
+    file->size = static_cast<size_t>(file_size.QuadPart);
+#else
+    int fd = ::open(file_path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return nullptr;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size <= 0) {
+        close(fd);
+        return nullptr;
+    }
+
+    void *mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping keeps its own reference to the file
+    if (mapping == MAP_FAILED)
+        return nullptr;
+
+    file->data = static_cast<const uint8_t *>(mapping);
+    file->size = static_cast<size_t>(info.st_size);
+    madvise(mapping, file->size, MADV_SEQUENTIAL);
+#endif
+
+    auto *buffer = static_cast<unsigned char *>(av_malloc(mapped_io_buffer_size));
+    if (!buffer)
+        return nullptr;
+    file->io_context = avio_alloc_context(buffer, mapped_io_buffer_size, 0, file.get(), read_packet, nullptr, seek);
+    if (!file->io_context) {
+        av_free(buffer);
+        return nullptr;
+    }
+
+    file->page_faults_at_open = count_page_faults();
+    file->read_ahead();
+    return file;
+}
+
+MappedFileIO::~MappedFileIO() {
+    if (io_context) {
+        av_freep(&io_context->buffer); // may have been replaced by ffmpeg, so not the one from open()
+        avio_context_free(&io_context);
+    }
+
+#if defined(_WIN32)
+    if (data)
+        UnmapViewOfFile(data);
+    if (mapping_handle)
+        CloseHandle(mapping_handle);
+    if (file_handle)
+        CloseHandle(file_handle);
+#else
+    if (data)
+        munmap(const_cast<uint8_t *>(data), size);
+#endif
+}
+
+uint64_t MappedFileIO::get_page_faults() const {
+    return count_page_faults() - page_faults_at_open;
+}
+
+int MappedFileIO::read_packet(void *opaque, uint8_t *buffer, int buffer_size) {
+    auto *file = static_cast<MappedFileIO *>(opaque);
+    size_t remaining = file->size - file->position;
+    if (remaining == 0)
+        return AVERROR_EOF;
+
+    size_t count = std::min(remaining, static_cast<size_t>(buffer_size));
+    std::memcpy(buffer, file->data + file->position, count);
+    file->position += count;
+    file->bytes_read.fetch_add(count, std::memory_order_relaxed);
+
+    // move the window forward before the reads catch up with it
+    if (file->position + readahead_window_bytes / 2 > file->readahead_end)
+        file->read_ahead();
+
+    return static_cast<int>(count);
+}
+
+int64_t MappedFileIO::seek(void *opaque, int64_t offset, int whence) {
+    auto *file = static_cast<MappedFileIO *>(opaque);
+    if (whence & AVSEEK_SIZE)
+        return file->size;
+
+    int64_t new_position;
+    switch (whence & ~AVSEEK_FORCE) {
+    case SEEK_SET:
+        new_position = offset;
+        break;
+    case SEEK_CUR:
+        new_position = file->position + offset;
+        break;
+    case SEEK_END:
+        new_position = file->size + offset;
+        break;
+    default:
+        return AVERROR(EINVAL);
+    }
+
+    if (new_position < 0 || new_position > static_cast<int64_t>(file->size))
+        return AVERROR(EINVAL);
+
+    file->position = static_cast<size_t>(new_position);
+    // the old window is behind us now, start reading where playback continues
+    file->read_ahead();
+    return new_position;
+}
+
+void MappedFileIO::read_ahead() {
+    static const size_t page_size = get_page_size();
+    size_t start = position / page_size * page_size;
+    size_t end = std::min(position + readahead_window_bytes, size);
+    if (start >= end)
+        return;
+
+    void *window = const_cast<uint8_t *>(data + start);
+#if defined(_WIN32)
+    WIN32_MEMORY_RANGE_ENTRY range {window, end - start};
+    PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#else
+    madvise(window, end - start, MADV_WILLNEED);
+#endif
+    readahead_end = end;
+}
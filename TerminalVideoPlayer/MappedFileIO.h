@@ -0,0 +1,56 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+extern "C" {
+#include <libavformat/avio.h>
+}
+
+// reads a local file for ffmpeg through a memory mapping instead of small buffered reads
+// the OS is asked to read ahead of the playback position, and the window follows seeks,
+// so on slow (network) storage the demuxer rarely has to wait for the disk
+class MappedFileIO {
+public:
+    // returns nullptr if the file can't be mapped (not a local file, too big for the address space, ...)
+    // in which case ffmpeg should just open the file itself
+    static std::unique_ptr<MappedFileIO> open(const std::string &file_path);
+    ~MappedFileIO();
+    MappedFileIO(const MappedFileIO &) = delete;
+    MappedFileIO &operator=(const MappedFileIO &) = delete;
+
+    // set as AVFormatContext::pb together with AVFMT_FLAG_CUSTOM_IO
+    inline AVIOContext *get_io_context() const {
+        return io_context;
+    }
+    inline uint64_t get_bytes_read() const {
+        return bytes_read.load(std::memory_order_relaxed);
+    }
+    // page faults that had to wait for the disk since the file was opened (all page faults on windows)
+    // the OS only counts them per process, so this includes the rest of the player
+    uint64_t get_page_faults() const;
+
+private:
+    MappedFileIO() = default;
+
+    static int read_packet(void *opaque, uint8_t *buffer, int buffer_size);
+    static int64_t seek(void *opaque, int64_t offset, int whence);
+    // asks the OS to start reading the window starting at the current position
+    void read_ahead();
+
+    const uint8_t *data = nullptr;
+    size_t size = 0;
+    size_t position = 0;
+    // end of the window the OS was last asked to read
+    size_t readahead_end = 0;
+    uint64_t page_faults_at_open = 0;
+    std::atomic<uint64_t> bytes_read {0};
+    AVIOContext *io_context = nullptr;
+
+#ifdef _WIN32
+    void *file_handle = nullptr;
+    void *mapping_handle = nullptr;
+#endif
+};
@@ -0,0 +1,128 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <string>
+#include "constants.h"
+#include "Pixel.h"
+#include "FramePool.h"
+#include "SPSCQueue.h"
+
+extern "C" {
+#include <libavutil/frame.h>
+}
+
+// playback runs as four threads linked by SPSCQueues:
+// decode -> scale -> render -> write
+// so that frame N+1 is being decoded while frame N is being turned into escape codes
+// and frame N-1 is being written to the terminal
+
+// every slot remembers the seek generation it was produced in,
+// after a seek the later stages throw away anything from an older generation
+
+// frames the DropController skips are never put in a queue, so they cost the later stages nothing
+
+struct DecodedFrame {
+    DecodedFrame() : frame {av_frame_alloc()} {}
+    ~DecodedFrame() {
+        av_frame_free(&frame);
+    }
+    DecodedFrame(const DecodedFrame &) = delete;
+    DecodedFrame &operator=(const DecodedFrame &) = delete;
+
+    // full resolution frame in the decoder's pixel format, references the decoder's buffer
+    AVFrame *frame;
+    long long frame_number {0};
+    // when the frame is due, in seconds on the same clock as the sound
+    double timestamp {0};
+    unsigned generation {0};
+};
+
+struct ScaledFrame {
+    PixelBuffer pixels;
+    long long frame_number {0};
+    double timestamp {0};
+    unsigned generation {0};
+    // intra coded, which is where encoders usually put scene cuts
+    bool keyframe {false};
+    // terminal size in cells, height is already converted to pixels (2 per row) minus the bars
+    int width {0};
+    int height {0};
+    // size of the resized frame in pixels
+    int actual_width {0};
+    int actual_height {0};
+};
+
+struct RenderedFrame {
+    std::string to_display;
+    long long frame_number {0};
+    double timestamp {0};
+    unsigned generation {0};
+    // the screen has to be cleared before to_display is written
+    bool clear_screen {false};
+    int actual_width {0};
+    int actual_height {0};
+};
+
+constexpr size_t decoded_queue_size = 3;
+constexpr size_t scaled_queue_size = 3;
+constexpr size_t rendered_queue_size = 3;
+
+typedef SPSCQueue<DecodedFrame, decoded_queue_size> DecodedQueue;
+typedef SPSCQueue<ScaledFrame, scaled_queue_size> ScaledQueue;
+typedef SPSCQueue<RenderedFrame, rendered_queue_size> RenderedQueue;
+
+// state shared between the stages and the main thread which handles the keyboard
+struct PlaybackState {
+    std::atomic<bool> quit {false};
+    std::atomic<bool> paused {false};
+    std::atomic<bool> redraw {false};
+    // frame the main thread wants to seek to, -1 if there is no pending seek
+    std::atomic<long long> seek_target {-1};
+    // incremented by the decode stage every time it seeks
+    std::atomic<unsigned> generation {0};
+
+    // set by each stage when it has nothing more to produce
+    std::atomic<bool> decode_done {false};
+    std::atomic<bool> scale_done {false};
+    std::atomic<bool> render_done {false};
+
+    // written by the write stage, read by the others
+    std::atomic<long long> curr_frame {1};
+    std::atomic<double> curr_fps {0};
+    std::atomic<double> avg_fps {0};
+    // seconds the last frame was shown after the sound got to it, negative if it had to wait
+    std::atomic<double> lateness {0};
+
+    // seconds each stage spends on a frame, averaged, for the DropController
+    std::atomic<double> decode_cost {0};
+    std::atomic<double> scale_cost {0};
+    std::atomic<double> render_cost {0};
+    std::atomic<double> write_cost {0};
+    // decoded but not written yet
+    std::atomic<int> frames_in_flight {0};
+    // written by the decode stage
+    std::atomic<double> shown_fraction {1};
+    // measured once the audio device is open, shown in the status bar
+    std::atomic<double> audio_latency {0};
+    // bytes and colour sequences (SGR) the render stage wrote for the picture of the last frame, shown in the status bar
+    std::atomic<double> frame_bytes {0};
+    std::atomic<double> sgr_per_row {0};
+    // the same over the whole playback, printed on exit
+    std::atomic<double> avg_frame_bytes {0};
+    std::atomic<double> avg_frame_ops {0};
+    std::atomic<double> avg_sgr_per_row {0};
+    // keyframes that changed so much of the picture that they were redrawn whole, and rows redrawn whole because it was shorter
+    std::atomic<long long> scene_cuts {0};
+    std::atomic<long long> full_rows {0};
+};
+
+inline void atomic_add(std::atomic<double> &value, double amount) {
+    double expected = value.load();
+    while (!value.compare_exchange_weak(expected, expected + amount));
+}
+
+// every cost has a single stage writing it, so it doesn't need atomic_add
+inline void update_cost(std::atomic<double> &cost, std::chrono::steady_clock::duration sample) {
+    double seconds = std::chrono::duration<double>(sample).count();
+    cost.store(cost.load() * (1 - cost_smoothing) + seconds * cost_smoothing);
+}
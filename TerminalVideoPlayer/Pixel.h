@@ -17,6 +17,22 @@ struct Pixel {
     }
 };
 
+// a pixel as one 32 bit word, red in the lowest byte and the top byte always 0
+// so a whole cell can be loaded and compared at once
+inline uint32_t pack_pixel(Pixel p) {
+    return p.r | (p.g << 8) | (static_cast<uint32_t>(p.b) << 16);
+}
+inline Pixel unpack_pixel(uint32_t packed) {
+    return {static_cast<uint8_t>(packed), static_cast<uint8_t>(packed >> 8), static_cast<uint8_t>(packed >> 16)};
+}
+// squared RGB distance between two packed pixels
+inline int distance_squared(uint32_t a, uint32_t b) {
+    int r = static_cast<int>(a & 0xFF) - static_cast<int>(b & 0xFF);
+    int g = static_cast<int>((a >> 8) & 0xFF) - static_cast<int>((b >> 8) & 0xFF);
+    int bl = static_cast<int>((a >> 16) & 0xFF) - static_cast<int>((b >> 16) & 0xFF);
+    return r * r + g * g + bl * bl;
+}
+
 struct TerminalPixel {
     TerminalPixel() : top_pixel {}, bottom_pixel {} {}
     TerminalPixel(Pixel top, Pixel bottom) : top_pixel {top}, bottom_pixel {bottom} {}
@@ -27,5 +43,12 @@ struct TerminalPixel {
     // bottom_pixel is the bottom half of the character block
     // this should be the foreground color
     Pixel bottom_pixel;
+
+    bool operator==(TerminalPixel other) const {
+        return top_pixel == other.top_pixel && bottom_pixel == other.bottom_pixel;
+    }
+    bool operator!=(TerminalPixel other) const {
+        return !(*this == other);
+    }
 };
 
@@ -0,0 +1,82 @@
+#include "PresentationTimer.h"
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define VC_EXTRALEAN
+#define NOMINMAX
+#include <Windows.h>
+#elif defined(__linux__)
+#include <cerrno>
+#include <time.h>
+#endif
+
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+PresentationTimer::PresentationTimer(std::chrono::nanoseconds spin_margin) : spin_margin {spin_margin} {
+#ifdef _WIN32
+    // high resolution timers exist since windows 10 1803, older versions get a normal one (~1ms, or worse)
+    timer = CreateWaitableTimerExW(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+    if (!timer)
+        timer = CreateWaitableTimerExW(nullptr, nullptr, 0, TIMER_ALL_ACCESS);
+#endif
+}
+
+PresentationTimer::~PresentationTimer() {
+#ifdef _WIN32
+    if (timer)
+        CloseHandle(timer);
+#endif
+}
+
+void PresentationTimer::sleep_until(std::chrono::steady_clock::time_point deadline) {
+#if defined(__linux__)
+    // steady_clock is CLOCK_MONOTONIC on linux, so its time points can be handed to the kernel as they are
+    auto since_epoch = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline.time_since_epoch()).count();
+    timespec wake_time {static_cast<time_t>(since_epoch / 1'000'000'000), static_cast<long>(since_epoch % 1'000'000'000)};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake_time, nullptr) == EINTR);
+#elif defined(_WIN32)
+    // waitable timers only take absolute times on the system clock, which can jump,
+    // so the deadline is turned into a relative one as late as possible
+    auto remaining = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - std::chrono::steady_clock::now()).count();
+    if (remaining <= 0)
+        return;
+    LARGE_INTEGER due_time;
+    due_time.QuadPart = -(remaining / 100); // negative means relative, in 100ns units
+    if (timer && SetWaitableTimer(timer, &due_time, 0, nullptr, nullptr, FALSE))
+        WaitForSingleObject(timer, INFINITE);
+    else
+        std::this_thread::sleep_until(deadline);
+#else
+    std::this_thread::sleep_until(deadline);
+#endif
+}
+
+void PresentationTimer::wait_until(std::chrono::steady_clock::time_point deadline) {
+    if (std::chrono::steady_clock::now() >= deadline)
+        return;
+
+    if (deadline - spin_margin > std::chrono::steady_clock::now())
+        sleep_until(deadline - spin_margin);
+    // only the last bit is spun, yielding so another stage can use the core meanwhile
+    while (std::chrono::steady_clock::now() < deadline)
+        std::this_thread::yield();
+
+    double lateness = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - deadline).count();
+    waits++;
+    total_lateness += lateness;
+    total_lateness_squared += lateness * lateness;
+    max_lateness = std::max(max_lateness, lateness);
+}
+
+JitterStats PresentationTimer::get_stats() const {
+    if (waits == 0)
+        return {};
+    double mean = total_lateness / waits;
+    double variance = std::max(total_lateness_squared / waits - mean * mean, 0.0);
+    return {waits, mean, std::sqrt(variance), max_lateness};
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+
+// how far the wakeups were from their deadlines, in microseconds
+struct JitterStats {
+    uint64_t waits {0};
+    double mean {0};
+    double standard_deviation {0};
+    double max {0};
+};
+
+// sleeps until absolute deadlines, so a late wakeup doesn't push every frame after it back
+// the OS timer is asked to wake up spin_margin early and the rest is spun away,
+// since a plain sleep can overshoot by a millisecond or more
+class PresentationTimer {
+public:
+    explicit PresentationTimer(std::chrono::nanoseconds spin_margin);
+    ~PresentationTimer();
+    PresentationTimer(const PresentationTimer &) = delete;
+    PresentationTimer &operator=(const PresentationTimer &) = delete;
+
+    // returns immediately if the deadline has passed already, that isn't counted as jitter
+    void wait_until(std::chrono::steady_clock::time_point deadline);
+    JitterStats get_stats() const;
+
+private:
+    void sleep_until(std::chrono::steady_clock::time_point deadline);
+
+    std::chrono::nanoseconds spin_margin;
+    uint64_t waits {0};
+    double total_lateness {0};
+    double total_lateness_squared {0};
+    double max_lateness {0};
+
+#ifdef _WIN32
+    void *timer = nullptr;
+#endif
+};
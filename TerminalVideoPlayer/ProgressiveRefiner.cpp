@@ -0,0 +1,78 @@
+#include "ProgressiveRefiner.h"
+#include <algorithm>
+
+static inline int cell_error(const ScreenBuffer &a, const ScreenBuffer &b, int row, int col) {
+    return distance_squared(a.top_row(row)[col], b.top_row(row)[col]) + distance_squared(a.bottom_row(row)[col], b.bottom_row(row)[col]);
+}
+
+void ProgressiveRefiner::resize(int rows, int cols) {
+    if (rows == this->rows && cols == this->cols)
+        return;
+    this->rows = rows;
+    this->cols = cols;
+
+    // 1 + centre_weight in the middle, falling off to 1 at the edges (and past them in the corners)
+    weights.resize(static_cast<size_t>(rows) * cols);
+    double half_rows = rows / 2.0;
+    double half_cols = cols / 2.0;
+    for (int row = 0; row < rows; row++) {
+        double dy = (row + 0.5 - half_rows) / half_rows;
+        for (int col = 0; col < cols; col++) {
+            double dx = (col + 0.5 - half_cols) / half_cols;
+            double closeness = std::max(0.0, 1 - (dx * dx + dy * dy));
+            weights[static_cast<size_t>(row) * cols + col] = static_cast<float>(1 + centre_weight * closeness);
+        }
+    }
+    carried_error.assign(static_cast<size_t>(rows) * cols, 0);
+}
+
+void ProgressiveRefiner::select(const ScreenBuffer &displayed, const ScreenBuffer &new_frame, ChangeMask &changes, double threshold, double budget, double cell_bytes, double move_bytes) {
+    resize(displayed.get_rows(), displayed.get_cols());
+
+    candidates.clear();
+    double min_error = threshold * threshold;
+    for (int row = 0; row < rows; row++) {
+        for (int col = changes.next_changed(row, 0); col >= 0; col = changes.next_changed(row, col + 1)) {
+            // every candidate is unmarked here and only the ones that fit are marked again below
+            changes.set_changed(row, col, false);
+            size_t index = static_cast<size_t>(row) * cols + col;
+            float error = carried_error[index] + cell_error(displayed, new_frame, row, col);
+            candidates.push_back({weights[index] * error, error >= min_error, row, col});
+        }
+    }
+
+    // the cells under the threshold only get what the others left of the budget, which is all of it once the picture stands still
+    std::sort(candidates.begin(), candidates.end(), [](const Candidate &a, const Candidate &b) {
+        if (a.over_threshold != b.over_threshold)
+            return a.over_threshold;
+        return a.priority > b.priority;
+    });
+
+    double spent = 0;
+    for (const Candidate &candidate : candidates) {
+        // a cell next to one that is drawn already joins its stretch without another cursor move
+        bool joins_stretch = (candidate.col > 0 && changes.is_changed(candidate.row, candidate.col - 1)) ||
+            (candidate.col + 1 < cols && changes.is_changed(candidate.row, candidate.col + 1));
+        double cost = cell_bytes + (joins_stretch ? 0 : move_bytes);
+        if (spent + cost > budget)
+            break;
+        spent += cost;
+        changes.set_changed(candidate.row, candidate.col, true);
+    }
+}
+
+void ProgressiveRefiner::update(const ScreenBuffer &displayed, const ScreenBuffer &new_frame) {
+    resize(displayed.get_rows(), displayed.get_cols());
+    for (int row = 0; row < rows; row++) {
+        for (int col = 0; col < cols; col++) {
+            float &carried = carried_error[static_cast<size_t>(row) * cols + col];
+            carried = displayed.top_row(row)[col] == new_frame.top_row(row)[col] && displayed.bottom_row(row)[col] == new_frame.bottom_row(row)[col]
+                ? 0
+                : carried + cell_error(displayed, new_frame, row, col);
+        }
+    }
+}
+
+void ProgressiveRefiner::reset() {
+    std::fill(carried_error.begin(), carried_error.end(), 0.0f);
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <vector>
+#include "ChangeMask.h"
+#include "ScreenBuffer.h"
+
+// picks which changed cells get drawn when a frame may only take so many bytes
+// cells are drawn biggest error first, weighted towards the middle of the picture, and the error of the cells
+// that didn't fit is added up from frame to frame, so a difference that stays on screen climbs the ranking
+// cells under the threshold are drawn last, with what is left of the budget, so still parts of the picture end up exact
+class ProgressiveRefiner {
+public:
+    explicit ProgressiveRefiner(double centre_weight) : centre_weight {centre_weight} {}
+
+    // changes has to mark every cell that differs at all (a threshold of 1), afterwards it only marks the ones to draw
+    // cell_bytes and move_bytes are what drawing a cell and moving the cursor are expected to cost
+    void select(const ScreenBuffer &displayed, const ScreenBuffer &new_frame, ChangeMask &changes, double threshold, double budget, double cell_bytes, double move_bytes);
+    // called once the frame was drawn, remembers the error of every cell that is still wrong
+    void update(const ScreenBuffer &displayed, const ScreenBuffer &new_frame);
+    // the screen was redrawn whole, nothing is owed anymore
+    void reset();
+
+private:
+    struct Candidate {
+        float priority;
+        bool over_threshold;
+        int row;
+        int col;
+    };
+
+    void resize(int rows, int cols);
+
+    double centre_weight;
+    int rows {0};
+    int cols {0};
+    // one per cell, row by row
+    std::vector<float> weights;
+    std::vector<float> carried_error;
+    std::vector<Candidate> candidates;
+};
@@ -0,0 +1,110 @@
+#include "RenderOps.h"
+#include "CursorMotion.h"
+#include "EscapeEncoder.h"
+
+static bool draws(const RenderOp &op) {
+    return op.type == RenderOpType::Glyph || op.type == RenderOpType::Repeat || op.type == RenderOpType::Erase;
+}
+
+static bool sets_color(const RenderOp &op) {
+    return op.type == RenderOpType::SetBg || op.type == RenderOpType::SetFg;
+}
+
+void RenderOps::optimize() {
+    SgrState sgr;
+    // at most one op is written for each kind of op read, so the list can be compacted in place
+    size_t kept = 0;
+    size_t i = 0;
+    while (i < ops.size()) {
+        if (draws(ops[i])) {
+            ops[kept++] = ops[i++];
+            continue;
+        }
+
+        std::optional<RenderOp> move;
+        std::optional<Pixel> bg;
+        std::optional<Pixel> fg;
+        for (; i < ops.size() && !draws(ops[i]); ++i) {
+            const RenderOp &op = ops[i];
+            if (op.type == RenderOpType::Move)
+                move = op;
+            else if (op.type == RenderOpType::SetBg)
+                bg = op.color;
+            else
+                fg = op.color;
+        }
+        if (i == ops.size())
+            break;
+
+        if (move.has_value())
+            ops[kept++] = *move;
+        if (bg.has_value() && sgr.bg != bg) {
+            ops[kept++] = {RenderOpType::SetBg, Glyph::Lower, *bg, 0, 0};
+            sgr.bg = bg;
+        }
+        if (fg.has_value() && sgr.fg != fg) {
+            ops[kept++] = {RenderOpType::SetFg, Glyph::Lower, *fg, 0, 0};
+            sgr.fg = fg;
+        }
+    }
+    ops.resize(kept);
+}
+
+RenderStats RenderOps::serialize(std::string &result, int screen_width) const {
+    RenderStats stats;
+    stats.ops = ops.size();
+    size_t start = result.size();
+    // the status bar was written before the frame, so the cursor isn't anywhere useful yet
+    CursorMotion cursor {screen_width};
+
+    for (size_t i = 0; i < ops.size(); ++i) {
+        const RenderOp &op = ops[i];
+        switch (op.type) {
+        case RenderOpType::Move: {
+            size_t before = result.size();
+            cursor.move_to(op.x, op.y, result);
+            stats.moves++;
+            stats.move_bytes += result.size() - before;
+            break;
+        }
+        case RenderOpType::SetBg:
+        case RenderOpType::SetFg: {
+            // ESC[48;2;r;g;b;38;2;r;g;bm instead of two sequences, optimize leaves at most one of each kind in a row
+            size_t end = i + 1;
+            while (end < ops.size() && end < i + 2 && sets_color(ops[end]))
+                end++;
+            append_sequence(result, max_color_pair_sequence_length, [&](char *out) {
+                *out++ = esc;
+                *out++ = '[';
+                for (size_t j = i; j < end; ++j) {
+                    if (j != i)
+                        *out++ = ';';
+                    out = encode_color_parameters(out, ops[j].color, ops[j].type == RenderOpType::SetBg);
+                }
+                *out++ = 'm';
+                return out;
+            });
+            stats.sgr_sequences++;
+            i = end - 1;
+            break;
+        }
+        case RenderOpType::Glyph:
+            result += glyph_text(op.glyph);
+            cursor.advance(1);
+            stats.cells++;
+            break;
+        case RenderOpType::Repeat:
+            append_sequence(result, max_cursor_sequence_length, [&](char *out) { return encode_run(out, op.x, 'b'); });
+            cursor.advance(op.x);
+            stats.cells += op.x;
+            break;
+        case RenderOpType::Erase:
+            append_sequence(result, max_cursor_sequence_length, [&](char *out) { return encode_run(out, op.x, 'X'); });
+            stats.cells += op.x;
+            break;
+        }
+    }
+
+    stats.bytes = result.size() - start;
+    return stats;
+}
@@ -0,0 +1,115 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "Pixel.h"
+#include "constants.h"
+
+// the lower half block shows the top pixel as the background and the bottom one as the foreground,
+// the upper half block the other way around, and a cell with one colour can be a space or a full block
+enum class Glyph : uint8_t {
+    Lower,
+    Upper,
+    Space,
+    Full
+};
+
+inline std::string_view glyph_text(Glyph glyph) {
+    switch (glyph) {
+    case Glyph::Lower:
+        return block;
+    case Glyph::Upper:
+        return upper_block;
+    case Glyph::Space:
+        return " ";
+    case Glyph::Full:
+        return full_block;
+    }
+    return block;
+}
+
+// the colours the terminal is drawing with, both are unknown at the start of a frame
+struct SgrState {
+    std::optional<Pixel> bg;
+    std::optional<Pixel> fg;
+};
+
+enum class RenderOpType : uint8_t {
+    // to the cell at x, y (0 based column, 1 based row like set_cursor)
+    Move,
+    SetFg,
+    SetBg,
+    // prints glyph at the cursor
+    Glyph,
+    // REP, prints the last glyph x more times
+    Repeat,
+    // ECH, blanks x cells with the background colour, the cursor stays where it is
+    Erase
+};
+
+struct RenderOp {
+    RenderOpType type;
+    Glyph glyph;
+    Pixel color;
+    int x;
+    int y;
+};
+
+// what serialize wrote
+struct RenderStats {
+    size_t ops {0};
+    size_t bytes {0};
+    size_t sgr_sequences {0};
+    // cells drawn, erased cells included
+    size_t cells {0};
+    size_t moves {0};
+    // the part of bytes that went into moving the cursor
+    size_t move_bytes {0};
+};
+
+// a frame as a list of drawing operations, built by the renderer, cleaned up by optimize and only then turned into
+// escape codes, so changes that only pay off across several cells (like merging colour changes) have one place to go
+class RenderOps {
+public:
+    // keeps the memory for the next frame
+    inline void clear() {
+        ops.clear();
+    }
+    inline void move(int x, int y) {
+        ops.push_back({RenderOpType::Move, Glyph::Lower, {}, x, y});
+    }
+    inline void set_bg(Pixel color) {
+        ops.push_back({RenderOpType::SetBg, Glyph::Lower, color, 0, 0});
+    }
+    inline void set_fg(Pixel color) {
+        ops.push_back({RenderOpType::SetFg, Glyph::Lower, color, 0, 0});
+    }
+    inline void glyph(Glyph glyph) {
+        ops.push_back({RenderOpType::Glyph, glyph, {}, 0, 0});
+    }
+    inline void repeat(int count) {
+        ops.push_back({RenderOpType::Repeat, Glyph::Lower, {}, count, 0});
+    }
+    inline void erase(int count) {
+        ops.push_back({RenderOpType::Erase, Glyph::Lower, {}, count, 0});
+    }
+
+    // peephole pass over the moves and colour changes between two drawing operations:
+    // only the last move and the last colour of each kind are kept, colours that are already set are dropped,
+    // and the moves go before the colours so the colours end up next to each other for serialize to merge
+    // moves and colours left at the end of the frame are never used, so they are dropped too
+    void optimize();
+    // appends the escape codes to result, with the cheapest cursor motion for every move
+    // and every run of colour changes merged into one sequence
+    RenderStats serialize(std::string &result, int screen_width) const;
+
+    inline size_t size() const {
+        return ops.size();
+    }
+
+private:
+    std::vector<RenderOp> ops;
+};
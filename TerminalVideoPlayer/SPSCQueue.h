@@ -0,0 +1,64 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+// bounded lock-free queue for exactly one producer thread and one consumer thread
+// all slots are constructed once up front and reused, the producer fills a slot in place
+// with acquire() + publish() and the consumer reads it in place with front() + pop()
+// so nothing gets copied or reallocated while the video is playing
+template <typename T, size_t Capacity>
+class SPSCQueue {
+public:
+    // producer side
+    // returns the next free slot, or nullptr if the queue is full
+    T *acquire() {
+        size_t tail = tail_index.load(std::memory_order_relaxed);
+        if (tail - cached_head >= Capacity) {
+            cached_head = head_index.load(std::memory_order_acquire);
+            if (tail - cached_head >= Capacity)
+                return nullptr;
+        }
+        return &slots[tail % Capacity];
+    }
+
+    // makes the slot returned by acquire() visible to the consumer
+    void publish() {
+        tail_index.store(tail_index.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // consumer side
+    // returns the oldest published slot, or nullptr if the queue is empty
+    T *front() {
+        size_t head = head_index.load(std::memory_order_relaxed);
+        if (head == cached_tail) {
+            cached_tail = tail_index.load(std::memory_order_acquire);
+            if (head == cached_tail)
+                return nullptr;
+        }
+        return &slots[head % Capacity];
+    }
+
+    // hands the slot returned by front() back to the producer
+    void pop() {
+        head_index.store(head_index.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // approximate when called from a thread that is neither the producer nor the consumer
+    size_t size() const {
+        return tail_index.load(std::memory_order_acquire) - head_index.load(std::memory_order_acquire);
+    }
+
+    static constexpr size_t capacity() {
+        return Capacity;
+    }
+
+private:
+    // the indices only ever grow, the slot is index % Capacity
+    // each one lives on its own cache line so the two threads don't fight over it
+    alignas(64) std::atomic<size_t> head_index {0};
+    size_t cached_tail {0}; // only touched by the consumer
+    alignas(64) std::atomic<size_t> tail_index {0};
+    size_t cached_head {0}; // only touched by the producer
+    alignas(64) std::array<T, Capacity> slots {};
+};
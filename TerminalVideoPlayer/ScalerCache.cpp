@@ -0,0 +1,40 @@
+#include "ScalerCache.h"
+#include <algorithm>
+#include <stdexcept>
+
+ScalerCache::~ScalerCache() {
+    clear();
+}
+
+SwsContext *ScalerCache::get(const ScalerKey &key) {
+    for (const auto &[cached_key, context] : contexts) {
+        if (cached_key == key)
+            return context;
+    }
+
+    auto stale = std::remove_if(contexts.begin(), contexts.end(), [&key](const auto &entry) {
+        if (entry.first.same_geometry(key))
+            return false;
+        sws_freeContext(entry.second);
+        return true;
+    });
+    contexts.erase(stale, contexts.end());
+
+    SwsContext *context = sws_getContext(
+        key.src_width, key.src_height, key.src_format,
+        key.dst_width, key.dst_height, key.dst_format,
+        key.flags, nullptr, nullptr, nullptr);
+
+    if (!context) {
+        throw std::runtime_error("Could not initialize resize SwsContext.");
+    }
+
+    contexts.emplace_back(key, context);
+    return context;
+}
+
+void ScalerCache::clear() {
+    for (const auto &entry : contexts)
+        sws_freeContext(entry.second);
+    contexts.clear();
+}
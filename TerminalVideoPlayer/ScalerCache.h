@@ -0,0 +1,74 @@
+#pragma once
+#include <array>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+extern "C" {
+#include <libswscale/swscale.h>
+}
+
+enum class ScalingAlgorithm {
+    FastBilinear,
+    Area,
+    Bicubic,
+    Lanczos
+};
+
+// names used on the command line and in the benchmark output
+constexpr std::array<std::pair<std::string_view, ScalingAlgorithm>, 4> scaling_algorithms {{
+    {"fast-bilinear", ScalingAlgorithm::FastBilinear},
+    {"area", ScalingAlgorithm::Area},
+    {"bicubic", ScalingAlgorithm::Bicubic},
+    {"lanczos", ScalingAlgorithm::Lanczos},
+}};
+
+constexpr int to_sws_flags(ScalingAlgorithm algorithm) {
+    switch (algorithm) {
+    case ScalingAlgorithm::FastBilinear:
+        return SWS_FAST_BILINEAR;
+    case ScalingAlgorithm::Area:
+        return SWS_AREA;
+    case ScalingAlgorithm::Lanczos:
+        return SWS_LANCZOS;
+    case ScalingAlgorithm::Bicubic:
+    default:
+        return SWS_BICUBIC;
+    }
+}
+
+struct ScalerKey {
+    int src_width;
+    int src_height;
+    AVPixelFormat src_format;
+    int dst_width;
+    int dst_height;
+    AVPixelFormat dst_format;
+    int flags;
+
+    bool same_geometry(const ScalerKey &other) const {
+        return src_width == other.src_width && src_height == other.src_height &&
+            dst_width == other.dst_width && dst_height == other.dst_height;
+    }
+    bool operator==(const ScalerKey &other) const {
+        return same_geometry(other) && src_format == other.src_format && dst_format == other.dst_format && flags == other.flags;
+    }
+};
+
+// keeps SwsContexts alive between frames
+// creating a context costs about as much as the scale itself at small terminal sizes
+class ScalerCache {
+public:
+    ScalerCache() = default;
+    ~ScalerCache();
+    ScalerCache(const ScalerCache &) = delete;
+    ScalerCache &operator=(const ScalerCache &) = delete;
+
+    // returns the context for key, creating it if needed
+    // contexts for any other geometry are freed since the terminal was resized and they won't be used again
+    SwsContext *get(const ScalerKey &key);
+    void clear();
+
+private:
+    std::vector<std::pair<ScalerKey, SwsContext *>> contexts;
+};
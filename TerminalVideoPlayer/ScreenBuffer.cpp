@@ -0,0 +1,78 @@
+#include "ScreenBuffer.h"
+#include <cstring>
+#include <stdexcept>
+#include "constants.h"
+
+#ifdef _MSC_VER
+#include <malloc.h>
+#else
+#include <cstdlib>
+#endif
+
+// a whole row of cells, so every row can be read with aligned SIMD loads no matter how ffmpeg was built
+constexpr size_t cells_alignment = screen_row_alignment * sizeof(uint32_t);
+
+// count is always a multiple of screen_row_alignment, which aligned_alloc needs
+static uint32_t *allocate_cells(size_t count) {
+#ifdef _MSC_VER
+    return static_cast<uint32_t *>(_aligned_malloc(count * sizeof(uint32_t), cells_alignment));
+#else
+    return static_cast<uint32_t *>(std::aligned_alloc(cells_alignment, count * sizeof(uint32_t)));
+#endif
+}
+
+static void free_cells(uint32_t *cells) {
+#ifdef _MSC_VER
+    _aligned_free(cells);
+#else
+    std::free(cells);
+#endif
+}
+
+ScreenBuffer::~ScreenBuffer() {
+    free_cells(cells);
+}
+
+void ScreenBuffer::resize(int rows, int cols) {
+    if (rows == this->rows && cols == this->cols)
+        return;
+
+    size_t new_stride = (static_cast<size_t>(cols) + screen_row_alignment - 1) / screen_row_alignment * screen_row_alignment;
+    size_t plane_size = new_stride * rows;
+    if (plane_size * 2 > capacity) {
+        free_cells(cells);
+        cells = allocate_cells(plane_size * 2);
+        if (!cells) {
+            capacity = 0;
+            this->rows = this->cols = 0;
+            throw std::runtime_error("Could not allocate screen buffer.");
+        }
+        capacity = plane_size * 2;
+    }
+
+    this->rows = rows;
+    this->cols = cols;
+    stride = new_stride;
+    top = cells;
+    bottom = cells + plane_size;
+    std::memset(cells, 0, plane_size * 2 * sizeof(uint32_t));
+}
+
+void ScreenBuffer::load(const Pixel *frame, int pixel_rows, int cols) {
+    resize((pixel_rows + 1) / 2, cols);
+    for (int row = 0; row < rows; ++row) {
+        const Pixel *top_pixels = frame + static_cast<size_t>(row * 2) * cols;
+        const Pixel *bottom_pixels = row * 2 + 1 < pixel_rows ? top_pixels + cols : top_pixels;
+        uint32_t *top_cells = top_row(row);
+        uint32_t *bottom_cells = bottom_row(row);
+        for (int col = 0; col < cols; ++col) {
+            top_cells[col] = pack_pixel(top_pixels[col]);
+            bottom_cells[col] = pack_pixel(bottom_pixels[col]);
+        }
+    }
+}
+
+void ScreenBuffer::copy_row(const ScreenBuffer &other, int row) {
+    std::memcpy(top_row(row), other.top_row(row), stride * sizeof(uint32_t));
+    std::memcpy(bottom_row(row), other.bottom_row(row), stride * sizeof(uint32_t));
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include "Pixel.h"
+
+// what the terminal is showing, one cell per character and two pixels per cell (the halves of the block)
+// the top and bottom pixels are kept in separate planes of packed 32 bit words in one aligned allocation,
+// rows are padded to whole cache lines so the change detection can compare many cells at a time
+// without a scalar tail, the padding cells are always 0 in every buffer so they never count as changed
+class ScreenBuffer {
+public:
+    ScreenBuffer() = default;
+    ~ScreenBuffer();
+    ScreenBuffer(const ScreenBuffer &) = delete;
+    ScreenBuffer &operator=(const ScreenBuffer &) = delete;
+
+    // memory is only reallocated when the buffer gets bigger than it has ever been
+    // the cells are cleared to black whenever the size changes
+    void resize(int rows, int cols);
+    // fills the buffer from a resized frame, every row of cells takes two rows of pixels
+    // an odd last row of pixels is used for both halves of its cells
+    void load(const Pixel *frame, int pixel_rows, int cols);
+
+    inline int get_rows() const {
+        return rows;
+    }
+    inline int get_cols() const {
+        return cols;
+    }
+    // words from the start of one row to the start of the next
+    inline size_t get_stride() const {
+        return stride;
+    }
+
+    inline uint32_t *top_row(int row) {
+        return top + row * stride;
+    }
+    inline const uint32_t *top_row(int row) const {
+        return top + row * stride;
+    }
+    inline uint32_t *bottom_row(int row) {
+        return bottom + row * stride;
+    }
+    inline const uint32_t *bottom_row(int row) const {
+        return bottom + row * stride;
+    }
+
+    // copies a row from a buffer of the same size
+    void copy_row(const ScreenBuffer &other, int row);
+
+    inline TerminalPixel get(int row, int col) const {
+        return {unpack_pixel(top_row(row)[col]), unpack_pixel(bottom_row(row)[col])};
+    }
+    inline void set(int row, int col, TerminalPixel pixel) {
+        top_row(row)[col] = pack_pixel(pixel.top_pixel);
+        bottom_row(row)[col] = pack_pixel(pixel.bottom_pixel);
+    }
+
+private:
+    // top plane followed by the bottom plane
+    uint32_t *cells = nullptr;
+    size_t capacity {0};
+    uint32_t *top = nullptr;
+    uint32_t *bottom = nullptr;
+    int rows {0};
+    int cols {0};
+    size_t stride {0};
+};
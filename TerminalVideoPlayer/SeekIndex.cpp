@@ -0,0 +1,178 @@
+#include "SeekIndex.h"
+#include <algorithm>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <system_error>
+#include "constants.h"
+
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+// what the cached index is checked against, if any of it changed the index is rebuilt
+struct IndexedFileInfo {
+    std::string path;
+    uintmax_t size;
+    long long modified_time;
+};
+
+static std::optional<IndexedFileInfo> get_file_info(const std::string &file_path) {
+    std::error_code error;
+    auto path = std::filesystem::absolute(file_path, error);
+    if (error)
+        return std::nullopt;
+    auto size = std::filesystem::file_size(path, error);
+    if (error)
+        return std::nullopt;
+    auto modified_time = std::filesystem::last_write_time(path, error);
+    if (error)
+        return std::nullopt;
+    return IndexedFileInfo {path.string(), size, static_cast<long long>(modified_time.time_since_epoch().count())};
+}
+
+static std::filesystem::path get_cache_path(const IndexedFileInfo &info) {
+    std::stringstream file_name;
+    file_name << std::hex << std::hash<std::string> {}(info.path) << seek_index_extension;
+    return std::filesystem::temp_directory_path() / seek_index_directory_name / file_name.str();
+}
+
+std::optional<SeekIndex> SeekIndex::load(const std::string &file_path) {
+    auto info = get_file_info(file_path);
+    if (!info)
+        return std::nullopt;
+
+    // the cache is in a shared directory, so anything in it could be truncated, corrupt or not written by us at all
+    // and every problem with it is just a cache miss
+    auto cache_path = get_cache_path(*info);
+    std::error_code error;
+    auto cache_size = std::filesystem::file_size(cache_path, error);
+    if (error)
+        return std::nullopt;
+
+    std::ifstream file {cache_path};
+    if (!file)
+        return std::nullopt;
+
+    std::string header;
+    std::string path;
+    std::getline(file, header);
+    std::getline(file, path);
+    if (header != seek_index_header || path != info->path)
+        return std::nullopt;
+
+    uintmax_t size;
+    long long modified_time;
+    size_t keyframe_count;
+    SeekIndex index;
+    file >> size >> modified_time >> index.total_frames >> keyframe_count;
+    if (!file || size != info->size || modified_time != info->modified_time || index.total_frames < 0)
+        return std::nullopt;
+    // a count the file is too short to hold is never allocated
+    if (keyframe_count > cache_size / min_seek_index_entry_size || keyframe_count > static_cast<unsigned long long>(index.total_frames))
+        return std::nullopt;
+
+    index.keyframes.resize(keyframe_count);
+    for (KeyframeEntry &keyframe : index.keyframes)
+        file >> keyframe.pts >> keyframe.pos >> keyframe.frame_number;
+    if (!file)
+        return std::nullopt;
+    // find_keyframe_before relies on the order
+    bool sorted = std::is_sorted(index.keyframes.begin(), index.keyframes.end(), [](const KeyframeEntry &a, const KeyframeEntry &b) {
+        return a.pts < b.pts;
+    });
+    if (!sorted)
+        return std::nullopt;
+
+    return index;
+}
+
+std::optional<SeekIndex> SeekIndex::build(const std::string &file_path, int video_stream_index, const std::atomic<bool> &cancel) {
+    // a separate context so this can run while the video is playing
+    AVFormatContext *format_context = nullptr;
+    if (avformat_open_input(&format_context, file_path.c_str(), nullptr, nullptr) != 0)
+        return std::nullopt;
+
+    if (avformat_find_stream_info(format_context, nullptr) < 0 || video_stream_index >= (int)format_context->nb_streams) {
+        avformat_close_input(&format_context);
+        return std::nullopt;
+    }
+
+    for (unsigned int i = 0; i < format_context->nb_streams; i++) {
+        if ((int)i != video_stream_index)
+            format_context->streams[i]->discard = AVDISCARD_ALL;
+    }
+
+    AVPacket *packet = av_packet_alloc();
+    if (!packet) {
+        avformat_close_input(&format_context);
+        return std::nullopt;
+    }
+
+    SeekIndex index;
+    while (!cancel && av_read_frame(format_context, packet) >= 0) {
+        if (packet->stream_index == video_stream_index) {
+            int64_t pts = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+            if ((packet->flags & AV_PKT_FLAG_KEY) && pts != AV_NOPTS_VALUE)
+                index.keyframes.push_back({pts, packet->pos, index.total_frames});
+            index.total_frames++;
+        }
+        av_packet_unref(packet);
+    }
+
+    bool cancelled = cancel;
+    av_packet_free(&packet);
+    avformat_close_input(&format_context);
+    if (cancelled)
+        return std::nullopt;
+
+    std::stable_sort(index.keyframes.begin(), index.keyframes.end(), [](const KeyframeEntry &a, const KeyframeEntry &b) {
+        return a.pts < b.pts;
+    });
+    return index;
+}
+
+void SeekIndex::save(const std::string &file_path) const {
+    auto info = get_file_info(file_path);
+    if (!info)
+        return;
+
+    auto cache_path = get_cache_path(*info);
+    std::error_code error;
+    std::filesystem::create_directories(cache_path.parent_path(), error);
+    if (error)
+        return;
+
+    // written next to the cache and renamed over it once complete, so a crash or another player
+    // saving the same index at the same time never leaves a half written file behind
+    std::stringstream temp_name;
+    temp_name << cache_path.filename().string() << '.' << std::hex << std::random_device {}() << seek_index_temp_extension;
+    auto temp_path = cache_path.parent_path() / temp_name.str();
+
+    // not being able to write the cache just means the index is built again next time
+    {
+        std::ofstream file {temp_path};
+        file << seek_index_header << '\n' << info->path << '\n';
+        file << info->size << ' ' << info->modified_time << ' ' << total_frames << ' ' << keyframes.size() << '\n';
+        for (const KeyframeEntry &keyframe : keyframes)
+            file << keyframe.pts << ' ' << keyframe.pos << ' ' << keyframe.frame_number << '\n';
+        file.close();
+        if (!file) {
+            std::filesystem::remove(temp_path, error);
+            return;
+        }
+    }
+
+    std::filesystem::rename(temp_path, cache_path, error);
+    if (error)
+        std::filesystem::remove(temp_path, error);
+}
+
+const KeyframeEntry *SeekIndex::find_keyframe_before(int64_t pts) const {
+    auto after = std::upper_bound(keyframes.begin(), keyframes.end(), pts, [](int64_t pts, const KeyframeEntry &keyframe) {
+        return pts < keyframe.pts;
+    });
+    if (after == keyframes.begin())
+        return nullptr;
+    return &*(after - 1);
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <vector>
+
+struct KeyframeEntry {
+    // in the video stream's time base
+    int64_t pts;
+    // byte offset of the keyframe's packet in the file, -1 if the demuxer doesn't know it
+    int64_t pos;
+    // number of video frames before this keyframe
+    long long frame_number;
+};
+
+// every keyframe of the video stream and the exact number of frames,
+// so seeking can jump straight to a keyframe even in containers with a poor index
+// (raw H.264, MPEG-TS, some MKVs) and the progress bar knows the real length
+class SeekIndex {
+public:
+    // reads the cached index for file_path, if there is one and the file hasn't changed since
+    static std::optional<SeekIndex> load(const std::string &file_path);
+    // reads every packet of the video stream without decoding it
+    // returns nothing if the file can't be read or cancel was set while building
+    static std::optional<SeekIndex> build(const std::string &file_path, int video_stream_index, const std::atomic<bool> &cancel);
+    // writes the index to the cache so the next time the file is opened it is loaded instead of built
+    void save(const std::string &file_path) const;
+
+    // last keyframe at or before pts, nullptr if pts is before the first keyframe
+    const KeyframeEntry *find_keyframe_before(int64_t pts) const;
+
+    inline long long get_total_frames() const {
+        return total_frames;
+    }
+
+private:
+    std::vector<KeyframeEntry> keyframes;
+    long long total_frames {0};
+};
@@ -0,0 +1,34 @@
+#include "TerminalCapabilities.h"
+#include <cstdlib>
+#include <string>
+
+static std::string get_environment(const char *name) {
+    const char *value = std::getenv(name);
+    return value ? value : "";
+}
+
+static bool supports_run_length() {
+    // multiplexers redraw the screen themselves, what reaches the real terminal is up to them
+    if (!get_environment("TMUX").empty() || !get_environment("STY").empty())
+        return false;
+
+    // windows terminal, the old console host doesn't know REP
+    if (!get_environment("WT_SESSION").empty())
+        return true;
+    // xterm sets this itself, unlike TERM=xterm which every terminal claims
+    if (!get_environment("XTERM_VERSION").empty())
+        return true;
+    // gnome terminal, tilix and the other VTE based terminals, REP arrived in 0.52
+    std::string vte_version = get_environment("VTE_VERSION");
+    if (!vte_version.empty() && std::atoi(vte_version.c_str()) >= 5200)
+        return true;
+
+    std::string term = get_environment("TERM");
+    std::string term_program = get_environment("TERM_PROGRAM");
+    return term.rfind("foot", 0) == 0 || term_program == "WezTerm";
+}
+
+TerminalCapabilities detect_terminal_capabilities(RunLengthMode mode) {
+    bool enabled = mode == RunLengthMode::On || (mode == RunLengthMode::Auto && supports_run_length());
+    return {enabled, enabled};
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <array>
+#include <string_view>
+#include <utility>
+
+enum class RunLengthMode {
+    Auto,
+    On,
+    Off
+};
+
+// names used on the command line
+constexpr std::array<std::pair<std::string_view, RunLengthMode>, 3> run_length_modes {{
+    {"auto", RunLengthMode::Auto},
+    {"on", RunLengthMode::On},
+    {"off", RunLengthMode::Off},
+}};
+
+// escape sequences that not every terminal understands, the renderer only uses them when they are set
+struct TerminalCapabilities {
+    // REP, ESC[nb prints the last character n more times
+    bool repeat {false};
+    // ECH, ESC[nX blanks n cells with the current background colour (background colour erase)
+    // and leaves the cursor where it is
+    bool erase {false};
+};
+
+// there is no reliable way to ask a terminal whether it supports REP, so auto goes by the environment
+// and only turns them on for terminals that are known to handle both
+TerminalCapabilities detect_terminal_capabilities(RunLengthMode mode);
@@ -5,20 +5,29 @@
 #include "AudioPlayer.h"
 #include <conio.h>
 #include <chrono>
-#include <iomanip>
+#include <cmath>
 #include <string>
 #include <locale>
 #include "VideoDecoder.h"
 #include "get_terminal_size.h"
 #include <array>
-#include <sstream>
 #include "utils.h"
 #include "constants.h"
 #include <fmt/core.h>
 #include <map>
 #include <optional>
-#include <filesystem>
 #include "commandline.h"
+#include "Pipeline.h"
+#include "benchmark.h"
+#include "PresentationTimer.h"
+#include "DropController.h"
+#include "ScreenBuffer.h"
+#include "ChangeMask.h"
+#include "CursorMotion.h"
+#include "EscapeEncoder.h"
+#include "TerminalCapabilities.h"
+#include "RenderOps.h"
+#include "ProgressiveRefiner.h"
 
 #ifdef _WIN32
 #include <windows.h>
@@ -54,149 +63,217 @@ int divmod(int &i, int d) {
 std::string format_seconds(int s) {
     int m {divmod(s, 60)};
     int h {divmod(m, 60)};
-    
-    std::stringstream formatted;
-    formatted << std::setfill('0') << std::setw(2);
+
+    // short enough to fit in the small string buffer, so this doesn't allocate
     if (h == 0)
-        formatted << m << ":" << std::setfill('0') << std::setw(2) << s;
+        return fmt::format("{:02}:{:02}", m, s);
     else
-        formatted << h << ":" << m << std::setfill('0') << std::setw(2) << ":" << std::setfill('0') << std::setw(2) << s;
-
-    return formatted.str();
+        return fmt::format("{}:{:02}:{:02}", h, m, s);
 }
 
-void display_status_bar(std::string &to_display, int curr_frame, int total_frames, int duration_seconds, int fps, double curr_fps, double avg_fps, int width, int height, double frames_to_drop) {
+void display_status_bar(std::string &to_display, int curr_frame, int total_frames, int duration_seconds, int fps, double curr_fps, double avg_fps, int width, int height, double shown_fraction, double audio_latency, double frame_bytes, double sgr_per_row) {
     int seconds_watched {curr_frame / fps};
-    std::string status_bar;
-    set_cursor(0, 0, status_bar);
+    set_cursor(0, 0, to_display);
     fmt::format_to(
-        std::back_inserter(status_bar),
-        "\033[0mFrame {}/{} {}x{} {}/{} {:.2f}fps, frames to drop: {:.2f} average fps: {:.2f}\n",
+        std::back_inserter(to_display),
+        "\033[0mFrame {}/{} {}x{} {}/{} {:.2f}fps, showing {:.0f}% of frames average fps: {:.2f} audio latency: {:.0f}ms {:.1f}KiB/frame {:.1f} SGR/row\n",
         curr_frame, total_frames, width, height,
         format_seconds(seconds_watched), format_seconds(duration_seconds),
-        curr_fps, frames_to_drop, avg_fps
+        curr_fps, shown_fraction * 100, avg_fps, audio_latency * 1000, frame_bytes / 1024, sgr_per_row
     );
-    to_display = status_bar + to_display;
 }
 
-inline void print_pixel(TerminalPixel pixel, size_t x, size_t y, std::string &result, const Frame &currently_displayed, std::pair<bool, bool> change_bg_fg_color) {
-    if (change_bg_fg_color.first)
-        set_color(pixel.top_pixel, true, result);
-    if (change_bg_fg_color.second)
-        set_color(pixel.bottom_pixel, false, result);
-
-    result += block;
-
-    if (x == currently_displayed[y].size() - 1) {
-        result.push_back(esc);
-        result += "[0m";
+struct CellEncoding {
+    Glyph glyph;
+    std::optional<Pixel> bg;
+    std::optional<Pixel> fg;
+    // bytes of the glyph and the colours that have to be set for it
+    int cost;
+};
+
+// the cheapest way to print pixel when the terminal has the colours in sgr set,
+// whichever colour is already set can usually be kept by picking the right glyph
+// ties go to the lower half block
+CellEncoding choose_encoding(TerminalPixel pixel, const SgrState &sgr) {
+    auto color_cost = [](const std::optional<Pixel> &current, std::optional<Pixel> wanted) {
+        return !wanted.has_value() || current == wanted ? 0 : color_sequence_length(*wanted);
+    };
+    auto consider = [&](CellEncoding &best, Glyph glyph, std::optional<Pixel> bg, std::optional<Pixel> fg) {
+        int cost = static_cast<int>(glyph_text(glyph).size()) + color_cost(sgr.bg, bg) + color_cost(sgr.fg, fg);
+        if (cost < best.cost)
+            best = {glyph, bg, fg, cost};
+    };
+
+    CellEncoding best {Glyph::Lower, pixel.top_pixel, pixel.bottom_pixel, 0};
+    best.cost = static_cast<int>(block_length) + color_cost(sgr.bg, best.bg) + color_cost(sgr.fg, best.fg);
+    consider(best, Glyph::Upper, pixel.bottom_pixel, pixel.top_pixel);
+    if (pixel.top_pixel == pixel.bottom_pixel) {
+        consider(best, Glyph::Space, pixel.top_pixel, std::nullopt);
+        consider(best, Glyph::Full, std::nullopt, pixel.top_pixel);
     }
+    return best;
 }
 
-void update_pixel(TerminalPixel new_pixel, std::pair<bool, bool> change_bg_fg_color, bool move_cursor, size_t x, size_t y, std::string &result, Frame &currently_displayed, int padding_left) {
-    currently_displayed[y][x] = new_pixel;
-    if (move_cursor)
-        set_cursor(x + padding_left, y + 2, result);
-    print_pixel(new_pixel, x, y, result, currently_displayed, change_bg_fg_color);
+// adds the colours the encoding needs and its glyph
+inline void add_cell(const CellEncoding &encoding, SgrState &sgr, RenderOps &ops) {
+    if (encoding.bg.has_value() && sgr.bg != encoding.bg) {
+        ops.set_bg(*encoding.bg);
+        sgr.bg = encoding.bg;
+    }
+    if (encoding.fg.has_value() && sgr.fg != encoding.fg) {
+        ops.set_fg(*encoding.fg);
+        sgr.fg = encoding.fg;
+    }
+    ops.glyph(encoding.glyph);
 }
 
-void init_currently_displayed(const std::unique_ptr<const Pixel[]> &start_frame, int rows, int cols, Frame &currently_displayed) {
-    currently_displayed.reserve(rows);
-    for (int row = 0; row < rows; row += 2) {
-        std::vector<TerminalPixel> curr_row;
-        curr_row.reserve(cols);
+// bytes of ESC[nb or ESC[nX, the count is left out when it is 1
+inline int run_sequence_length(int count) {
+    return count == 1 ? 3 : 3 + decimal_length(count);
+}
 
-        for (int col = 0; col < cols; ++col) {
-            Pixel top_pixel = start_frame[row * cols + col];
-            Pixel bottom_pixel = row + 1 < rows ? start_frame[(row + 1) * cols + col] : top_pixel;
-            curr_row.emplace_back(top_pixel, bottom_pixel);
+// adds count copies of pixel, with REP or ECH when the terminal has them and they are shorter
+// ECH leaves the cursor where it was, returns how far right the cursor moved
+// erase_move_cost is what moving past the erased cells afterwards is going to cost
+int add_run(TerminalPixel pixel, int count, bool ends_row, SgrState &sgr, RenderOps &ops, const TerminalCapabilities &capabilities, int erase_move_cost) {
+    // the cells after the first don't need any colours
+    CellEncoding encoding {choose_encoding(pixel, sgr)};
+    int glyph_length = static_cast<int>(glyph_text(encoding.glyph).size());
+    int plain_cost = encoding.cost + (count - 1) * glyph_length;
+    int repeat_cost = count > 1 && capabilities.repeat ? encoding.cost + run_sequence_length(count - 1) : plain_cost;
+
+    // an erased cell is a space on the background colour, so only cells with the same colour in both halves can be erased
+    if (capabilities.erase && pixel.top_pixel == pixel.bottom_pixel) {
+        bool change_bg = sgr.bg != pixel.top_pixel;
+        int erase_cost = (change_bg ? color_sequence_length(pixel.top_pixel) : 0) + run_sequence_length(count) + (ends_row ? 0 : erase_move_cost);
+        if (erase_cost < std::min(plain_cost, repeat_cost)) {
+            if (change_bg) {
+                ops.set_bg(pixel.top_pixel);
+                sgr.bg = pixel.top_pixel;
+            }
+            ops.erase(count);
+            return 0;
         }
+    }
 
-        currently_displayed.push_back(curr_row);
+    add_cell(encoding, sgr, ops);
+    if (repeat_cost < plain_cost) {
+        ops.repeat(count - 1);
+    } else {
+        for (int i = 1; i < count; ++i)
+            ops.glyph(encoding.glyph);
     }
+    return count;
 }
 
-void process_new_frame(const std::unique_ptr<const Pixel[]> &frame, size_t rows, int cols, std::string &result, Frame &currently_displayed, const std::string &left_padding, int optimization_threshold) {
-    bool last_pixel_changed {false};
-    std::optional<TerminalPixel> last_p;
-    for (size_t row = 0; row < currently_displayed.size(); row++) {
-        const auto &curr_row {currently_displayed[row]};
-        for (int col = 0; col < cols; ++col) {
-            TerminalPixel p {curr_row[col]};
-
-            Pixel top_new_pixel {frame[(row * 2) * cols + col]};
-            Pixel bottom_new_pixel;
-            if (row * 2 + 1 < rows)
-                bottom_new_pixel = frame[(row * 2 + 1) * cols + col];
-            else
-                bottom_new_pixel = top_new_pixel;
-            TerminalPixel new_p {top_new_pixel, bottom_new_pixel};
-
-            if (distance(p.top_pixel, new_p.top_pixel) >= optimization_threshold ||
-                distance(p.bottom_pixel, new_p.bottom_pixel) >= optimization_threshold
-            ) {
-                bool should_move_cursor = (!last_pixel_changed || (col == 0));
-                std::pair<bool, bool> change_bg_fg_color {false, false};
-                if (last_p.has_value())
-                    change_bg_fg_color = {last_p->top_pixel != new_p.top_pixel, last_p->bottom_pixel != new_p.bottom_pixel};
-                else {
-                    change_bg_fg_color = {true, true};
-                    last_p = new_p;
-                }
-                if (should_move_cursor) {
-                    change_bg_fg_color.first = true;
-                    change_bg_fg_color.second = true;
+// average bytes a drawn cell and a cursor move took in the frames rendered so far
+struct RenderEstimates {
+    double cell_bytes {default_cell_bytes};
+    double move_bytes {default_move_bytes};
+};
+
+// draws every cell of the row, reaching it with a move rather than a newline so nothing is written over the padding
+// and the colours don't have to be reset at the end of each row
+void add_row(const ScreenBuffer &frame, int row, int padding_left, SgrState &sgr, RenderOps &ops, const TerminalCapabilities &capabilities) {
+    int cols = frame.get_cols();
+    int y = row + 2;
+    ops.move(padding_left, y);
+    for (int x = 0; x < cols;) {
+        TerminalPixel pixel {frame.get(row, x)};
+        int count = 1;
+        while (x + count < cols && frame.get(row, x + count) == pixel)
+            count++;
+
+        int erase_move_cost = run_sequence_length(count);
+        if (add_run(pixel, count, x + count == cols, sgr, ops, capabilities, erase_move_cost) == 0 && x + count < cols)
+            ops.move(padding_left + x + count, y);
+        x += count;
+    }
+}
+
+// cursor is only used for its costs here, the real moves are picked again when the ops are serialized
+// rows are redrawn whole when that is estimated to be shorter than visiting the changed cells one stretch at a time,
+// returns how many were
+int process_new_frame(const ScreenBuffer &new_frame, const ChangeMask &changes, RenderOps &ops, ScreenBuffer &currently_displayed, CursorMotion &cursor, int padding_left, const TerminalCapabilities &capabilities, const RenderEstimates &estimates) {
+    int full_rows = 0;
+    int cols = currently_displayed.get_cols();
+    double full_row_cost = estimates.move_bytes + cols * estimates.cell_bytes;
+    SgrState sgr;
+    for (int row = 0; row < currently_displayed.get_rows(); row++) {
+        int changed = changes.count_changed(row);
+        if (changed == 0)
+            continue;
+        double diff_cost = changes.count_runs(row) * estimates.move_bytes + changed * estimates.cell_bytes;
+        if (full_row_cost < diff_cost) {
+            // also puts back the cells that differ by less than the threshold
+            add_row(new_frame, row, padding_left, sgr, ops, capabilities);
+            currently_displayed.copy_row(new_frame, row);
+            // near enough, an erase at the end of the row leaves the cursor a bit further left
+            cursor.moved_to(padding_left, row + 2);
+            cursor.advance(cols);
+            full_rows++;
+            continue;
+        }
+
+        // only the changed cells are visited, a whole word of unchanged cells is skipped at once
+        for (int col = changes.next_changed(row, 0); col >= 0; col = changes.next_changed(row, col)) {
+            int x = col + padding_left;
+            int y = row + 2;
+            TerminalPixel new_p {new_frame.get(row, col)};
+
+            if (!cursor.is_at(x, y)) {
+                // the unchanged cells the cursor would skip can be printed again instead,
+                // which is often shorter when there are only a few of them, even if they need their own colours
+                int gap = cursor.cells_before(x, y);
+                int jump_cost = cursor.cost(x, y) + choose_encoding(new_p, sgr).cost;
+                bool bridge = false;
+                if (gap > 0 && gap <= col && gap * static_cast<int>(block_length) < jump_cost) {
+                    int bridge_cost = 0;
+                    SgrState bridge_sgr = sgr;
+                    for (int gap_col = col - gap; gap_col < col && bridge_cost < jump_cost; ++gap_col) {
+                        CellEncoding encoding {choose_encoding(currently_displayed.get(row, gap_col), bridge_sgr)};
+                        bridge_cost += encoding.cost;
+                        if (encoding.bg.has_value())
+                            bridge_sgr.bg = encoding.bg;
+                        if (encoding.fg.has_value())
+                            bridge_sgr.fg = encoding.fg;
+                    }
+                    bridge = bridge_cost + choose_encoding(new_p, bridge_sgr).cost < jump_cost;
                 }
-                update_pixel(
-                    new_p,
-                    change_bg_fg_color,
-                    should_move_cursor,
-                    col,
-                    row,
-                    result,
-                    currently_displayed,
-                    left_padding.size()
-                );
-                last_pixel_changed = true;
-                if (last_p.has_value()) {
-                    if (change_bg_fg_color.first)
-                        last_p->top_pixel = new_p.top_pixel;
-                    if (change_bg_fg_color.second)
-                        last_p->bottom_pixel = new_p.bottom_pixel;
+
+                if (bridge) {
+                    for (int gap_col = col - gap; gap_col < col; ++gap_col)
+                        add_cell(choose_encoding(currently_displayed.get(row, gap_col), sgr), sgr, ops);
+                    cursor.advance(gap);
+                } else {
+                    ops.move(x, y);
+                    cursor.moved_to(x, y);
                 }
-            } else {
-                last_pixel_changed = false;
             }
+
+            // changed cells right after this one that changed to the same thing are printed as one run
+            int count = 1;
+            while (col + count < cols && changes.is_changed(row, col + count) && new_frame.get(row, col + count) == new_p)
+                count++;
+            for (int i = 0; i < count; ++i)
+                currently_displayed.set(row, col + i, new_p);
+            // after ECH the next jump starts from the erased cells instead of after them, which costs about the same
+            cursor.advance(add_run(new_p, count, col + count == cols, sgr, ops, capabilities, 0));
+            col += count;
         }
     }
+    return full_rows;
 }
 
-void display_entire_frame(std::string &result, const Frame &currently_displayed, const std::string &left_padding) {
-    size_t y = 0;
-    for (const std::vector<TerminalPixel> &row : currently_displayed) {
-        result += left_padding;
-        size_t x = 0;
-        TerminalPixel last_pixel;
-        for (TerminalPixel pixel : row) {
-            std::pair<bool, bool> change_bg_fg_color {false, false};
-            if (pixel.top_pixel != last_pixel.top_pixel)
-                change_bg_fg_color.first = true;
-            if (pixel.bottom_pixel != last_pixel.bottom_pixel)
-                change_bg_fg_color.second = true;
-
-            print_pixel(pixel, x, y, result, currently_displayed, change_bg_fg_color);
-            if (x == row.size() - 1) {
-                result.push_back('\n');
-            }
-            last_pixel = pixel;
-            x++;
-        }
-        y++;
-    }
+void display_entire_frame(RenderOps &ops, const ScreenBuffer &currently_displayed, int padding_left, const TerminalCapabilities &capabilities) {
+    SgrState sgr;
+    for (int row = 0; row < currently_displayed.get_rows(); row++)
+        add_row(currently_displayed, row, padding_left, sgr, ops, capabilities);
 }
 
 void draw_progressbar(int current_frame, int total_frames, int width, std::string &to_display) {
-    double progress = (static_cast<double>(current_frame) / total_frames);
+    // total_frames is only an estimate until the seek index is ready
+    double progress = total_frames > 0 ? std::min(static_cast<double>(current_frame) / total_frames, 1.0) : 0.0;
     int whole_width = std::floor(progress * width);
     double remainder_width = fmod(progress * width, 1.0);
     int part_width = std::floor(remainder_width * 8);
@@ -215,171 +292,444 @@ void draw_progressbar(int current_frame, int total_frames, int width, std::strin
     }
 }
 
-int main(int argc, char *argv[]) {
-    auto [always_redraw, optimization_threshold, video_file] = parse_command_line(argc, argv);
+// spins for a little while and then backs off to short sleeps until get_slot() returns a slot
+// returns nullptr once playback is quitting, or once upstream_done is set and nothing is left
+template <typename GetSlot>
+auto wait_for_slot(GetSlot get_slot, const PlaybackState &state, const std::atomic<bool> *upstream_done = nullptr) -> decltype(get_slot()) {
+    for (int attempt = 0; ; ++attempt) {
+        if (auto slot = get_slot())
+            return slot;
+        if (state.quit)
+            return nullptr;
+        if (upstream_done && *upstream_done)
+            return get_slot(); // the last slot could have been published right before upstream_done was set
+        if (attempt < wait_spin_attempts)
+            std::this_thread::yield();
+        else
+            std::this_thread::sleep_for(wait_backoff_time);
+    }
+}
 
-    std::setlocale(LC_ALL, "");
+void decode_stage(VideoDecoder &video, DecodedQueue &output, PlaybackState &state, double fps, bool accurate_seek) {
+    DropController drop_controller {fps};
+    // runs until the end of the stream rather than total_frames, which can be an estimate
+    for (long long curr_frame = 1; !state.quit; ++curr_frame) {
+        long long seek_target = state.seek_target.exchange(-1);
+        if (seek_target >= 0) {
+            // frame 1 is at 0 seconds, the loop increment then numbers the frame the seek landed on
+            curr_frame = std::llround(video.skip_to_timestamp((seek_target - 1) / fps, accurate_seek) * fps);
+            state.generation++;
+            state.lateness = 0;
+            drop_controller.reset();
+            continue;
+        }
 
-#ifdef _WIN32
-    EnableVirtualTerminalProcessing();
-#endif
+        DecodedFrame *decoded = wait_for_slot([&] { return output.acquire(); }, state);
+        if (!decoded)
+            break;
 
-    std::cout << "\033[?1049h"; // save current terminal content to restore later
+        decoded->generation = state.generation;
+        // the decoder is told up front so it can skip the work nobody will see
+        int skip = drop_controller.frames_to_skip(state, curr_frame);
+        if (skip > 0) {
+            if (!video.drop_frames(skip, drop_controller.is_catching_up()))
+                break;
+            curr_frame += skip;
+        }
 
-    const auto temp_directory {create_temp_directory()};
+        auto start = std::chrono::steady_clock::now();
+        if (!video.get_next_frame(decoded->frame))
+            break;
+        update_cost(state.decode_cost, std::chrono::steady_clock::now() - start);
+
+        std::optional<double> frame_time = video.get_frame_time(decoded->frame);
+        // after a drop the count can be off by the frames the decoder skipped on its own,
+        // so it is renumbered the same way a seek is
+        if (skip > 0 && frame_time)
+            curr_frame = std::llround(*frame_time * fps) + 1;
+        decoded->timestamp = frame_time.value_or((curr_frame - 1) / fps);
+        decoded->frame_number = curr_frame;
+        state.frames_in_flight++;
+        output.publish();
+    }
+    state.decode_done = true;
+}
 
-    // convert video to .wav file so miniaudio can play it
-    const auto actual_audio_file = (temp_directory / audio_file_name);
-    std::system(fmt::format("ffmpeg -i \"{}\" \"{}\"", video_file, actual_audio_file.string()).c_str());
+void scale_stage(VideoDecoder &video, DecodedQueue &input, ScaledQueue &output, PlaybackState &state) {
+    while (true) {
+        DecodedFrame *decoded = wait_for_slot([&] { return input.front(); }, state, &state.decode_done);
+        if (!decoded)
+            break;
+        if (decoded->generation != state.generation) {
+            input.pop();
+            state.frames_in_flight--;
+            continue;
+        }
 
-    AudioPlayer audio_player {actual_audio_file.string().c_str(), skip_seconds};
+        ScaledFrame *scaled = wait_for_slot([&] { return output.acquire(); }, state);
+        if (!scaled)
+            break;
 
-    VideoDecoder video {video_file};
+        auto start = std::chrono::steady_clock::now();
+        scaled->frame_number = decoded->frame_number;
+        scaled->timestamp = decoded->timestamp;
+        scaled->generation = decoded->generation;
+        scaled->keyframe = decoded->frame->pict_type == AV_PICTURE_TYPE_I;
 
-    long long total_frames {video.get_total_frames()};
-    double fps {video.get_fps()};
-    double duration_seconds {total_frames / fps};
-    double curr_fps {};
-    const std::chrono::nanoseconds target_frame_time {static_cast<long long>((1.0 / fps) * nano_seconds_in_second)};
-    auto next_target_frame_time = target_frame_time;
-    std::pair last_size {0, 0};
-    double frames_to_drop {};
-    int seek_frames = static_cast<int>(skip_seconds * fps); // Number of frames to seek for 5 seconds
+        auto [width, height] = get_terminal_size();
+        height = height * 2 - 4;
 
-    audio_player.get_sample_rate();
+        auto [actual_width, actual_height] = video.resize_frame(decoded->frame, scaled->pixels, width, height);
+        scaled->width = width;
+        scaled->height = height;
+        scaled->actual_width = actual_width;
+        scaled->actual_height = actual_height;
+        update_cost(state.scale_cost, std::chrono::steady_clock::now() - start);
 
-    double avg_fps {};
+        av_frame_unref(decoded->frame); // gives the buffer back to the decoder
+        input.pop();
+        output.publish();
+    }
+    state.scale_done = true;
+}
 
-    Frame currently_displayed;
+// byte_budget limits the bytes of the picture of every frame that isn't redrawn whole, 0 doesn't limit it
+void render_stage(const VideoDecoder &video, ScaledQueue &input, RenderedQueue &output, PlaybackState &state, bool always_redraw, double optimization_threshold, double fps, TerminalCapabilities capabilities, double byte_budget, double centre_weight) {
+    // what is on the screen and the frame being compared with it, both are reused for every frame
+    ScreenBuffer currently_displayed;
+    ScreenBuffer new_frame;
+    ChangeMask changes;
+    RenderOps ops;
+    RenderEstimates estimates;
+    ProgressiveRefiner refiner {centre_weight};
 
     int last_width {0};
     int last_height {0};
-
-    bool should_redraw = false;
-
-    std::string left_padding;
-    std::string to_display;
-
-    std::chrono::nanoseconds last_elapsed_time;
-
-    audio_player.play();
-
-    for (long long curr_frame = 1; curr_frame < total_frames; ++curr_frame) {
-        auto startTime = std::chrono::steady_clock::now();
-        if (_kbhit()) {
-            char key = _getch();
-            if (key == ' ' || key == 'k') {
-                // pause
-                audio_player.pause();
-                while (true) {
-                    key = _getch();
-                    if (key == ' ' || key == 'k')
-                        break;
-                    else if (key == 'q') {
-                        curr_frame = total_frames;
-                        break;
-                    }
-                }
-                audio_player.play();
-            } else if (key == 'l') {
-                // seek forward
-                curr_frame = std::min(curr_frame + seek_frames, total_frames - 1);
-                curr_frame = video.skip_to_timestamp(curr_frame / fps) * fps;
-                continue;
-            } else if (key == 'j') {
-                // seek backward
-                curr_frame = std::max(curr_frame - seek_frames, 1ll);
-                curr_frame = video.skip_to_timestamp(curr_frame / fps) * fps;
-                continue;
-            } else if (key == 'q')
-                break;
-            else if (key == 'r')
-                should_redraw = true;
-            startTime = std::chrono::steady_clock::now();
-        }
-
-        const AVFrame *data = video.get_next_frame();
-
-        if (!data) {
-            std::cerr << "Failed to get next frame" << std::endl;
+    // the picture can change size without the terminal doing so, when the video's resolution changes midway
+    int last_actual_width {0};
+    int last_actual_height {0};
+    bool first_frame {true};
+    // the write stage throws away what was rendered before a seek, so the screen can be behind currently_displayed
+    // and the first frame of every generation is drawn whole, clearing the screen again if a dropped frame would have
+    unsigned generation {0};
+    bool cleared_in_generation {false};
+
+    long long frames_rendered {0};
+    double total_frame_bytes {0};
+    double total_frame_ops {0};
+    double total_sgr_per_row {0};
+
+    while (true) {
+        ScaledFrame *scaled = wait_for_slot([&] { return input.front(); }, state, &state.scale_done);
+        if (!scaled)
             break;
-        }
-
-        if (frames_to_drop > 1) {
-            display_status_bar(to_display, curr_frame, total_frames, duration_seconds, fps, curr_fps, avg_fps, currently_displayed[0].size(), currently_displayed.size() * 2, frames_to_drop);
-            fmt::print(stdout, to_display);
-            to_display.clear();
-            frames_to_drop--;
-
+        if (scaled->generation != state.generation) {
+            input.pop();
+            state.frames_in_flight--;
             continue;
         }
 
-        auto [width, height] = get_terminal_size();
-        height = height * 2 - 4;
-
-        std::unique_ptr<const Pixel[]> new_data = nullptr;
-        auto [actual_width, actual_height] = video.resize_frame(data, new_data, width, height);
+        RenderedFrame *rendered = wait_for_slot([&] { return output.acquire(); }, state);
+        if (!rendered)
+            break;
 
+        auto start = std::chrono::steady_clock::now();
+        std::string &to_display = rendered->to_display;
+        to_display.clear();
+        rendered->frame_number = scaled->frame_number;
+        rendered->timestamp = scaled->timestamp;
+        rendered->generation = scaled->generation;
+        rendered->clear_screen = false;
+
+        // can change while playing once the seek index has counted the frames
+        long long total_frames {video.get_total_frames()};
+        double duration_seconds {total_frames / fps};
+
+        int width = scaled->width;
+        int height = scaled->height;
+        int actual_width = scaled->actual_width;
+        int actual_height = scaled->actual_height;
         int padding_left = (width - actual_width) / 2;
 
-        if (curr_frame == 1 || width != last_width || height != last_height || should_redraw || always_redraw) {
-            if (curr_frame == 1 || width != last_width || height != last_height) {
+        // written first so the frame can be appended to the same buffer without moving it
+        display_status_bar(to_display, scaled->frame_number, total_frames, duration_seconds, fps, state.curr_fps, state.avg_fps, actual_width, (actual_height + 1) / 2 * 2, state.shown_fraction, state.audio_latency, state.frame_bytes, state.sgr_per_row);
+
+        bool should_redraw = state.redraw.exchange(false);
+        bool new_generation = scaled->generation != generation;
+        if (new_generation) {
+            rendered->clear_screen = cleared_in_generation;
+            cleared_in_generation = false;
+            generation = scaled->generation;
+        }
+        bool size_changed = first_frame || width != last_width || height != last_height ||
+            actual_width != last_actual_width || actual_height != last_actual_height;
+        ops.clear();
+        if (size_changed || new_generation || should_redraw || always_redraw) {
+            if (size_changed) {
                 to_display.reserve(width * height * 3);
-                left_padding.resize(padding_left, ' ');
-                clear_screen();
+                rendered->clear_screen = true;
             }
-            currently_displayed.clear();
-
-            init_currently_displayed(new_data, actual_height, actual_width, currently_displayed);
-            display_entire_frame(to_display, currently_displayed, left_padding);
+            cleared_in_generation |= rendered->clear_screen;
+            currently_displayed.load(scaled->pixels.get(), actual_height, actual_width);
+            display_entire_frame(ops, currently_displayed, padding_left, capabilities);
+            refiner.reset();
             last_height = height;
             last_width = width;
-            should_redraw = false;
+            last_actual_width = actual_width;
+            last_actual_height = actual_height;
+            first_frame = false;
         } else {
-            process_new_frame(new_data, actual_height, actual_width, to_display, currently_displayed, left_padding, optimization_threshold);
+            new_frame.load(scaled->pixels.get(), actual_height, actual_width);
+            // with a budget the refiner applies the threshold itself, to the error added up over several frames,
+            // so it gets every cell that differs at all: 1 is the smallest distance two different colours can have
+            // (a threshold of 0 would mark the cells that are exactly the same too)
+            bool budgeted = byte_budget > 0;
+            changes.compute(currently_displayed, new_frame, budgeted ? 1 : optimization_threshold);
+            size_t cells = static_cast<size_t>(new_frame.get_rows()) * new_frame.get_cols();
+            // encoders put keyframes at scene cuts but also every few seconds, only the first kind changes most of the picture
+            // nearly every cell would be drawn anyway, so the whole frame is drawn exactly, threshold or not
+            // a budget is never exceeded for it, the refiner gets to the new scene over the next few frames instead
+            if (!budgeted && scaled->keyframe && changes.count_changed() >= scene_cut_changed_fraction * cells) {
+                currently_displayed.load(scaled->pixels.get(), actual_height, actual_width);
+                display_entire_frame(ops, currently_displayed, padding_left, capabilities);
+                state.scene_cuts++;
+            } else {
+                if (budgeted)
+                    refiner.select(currently_displayed, new_frame, changes, optimization_threshold, byte_budget, estimates.cell_bytes, estimates.move_bytes);
+                CursorMotion cursor {width};
+                state.full_rows += process_new_frame(new_frame, changes, ops, currently_displayed, cursor, padding_left, capabilities, estimates);
+                if (budgeted)
+                    refiner.update(currently_displayed, new_frame);
+            }
         }
-
-        display_status_bar(to_display, curr_frame, total_frames, duration_seconds, fps, curr_fps, avg_fps, currently_displayed[0].size(), currently_displayed.size() * 2, frames_to_drop);
+        rendered->actual_width = actual_width;
+        rendered->actual_height = actual_height;
+
+        ops.optimize();
+        RenderStats stats {ops.serialize(to_display, width)};
+        if (stats.cells > 0)
+            estimates.cell_bytes = estimates.cell_bytes * (1 - cost_smoothing) + static_cast<double>(stats.bytes - stats.move_bytes) / stats.cells * cost_smoothing;
+        if (stats.moves > 0)
+            estimates.move_bytes = estimates.move_bytes * (1 - cost_smoothing) + static_cast<double>(stats.move_bytes) / stats.moves * cost_smoothing;
+        double sgr_per_row = static_cast<double>(stats.sgr_sequences) / std::max(currently_displayed.get_rows(), 1);
+        state.frame_bytes = static_cast<double>(stats.bytes);
+        state.sgr_per_row = sgr_per_row;
+        frames_rendered++;
+        total_frame_bytes += stats.bytes;
+        total_frame_ops += stats.ops;
+        total_sgr_per_row += sgr_per_row;
+        state.avg_frame_bytes = total_frame_bytes / frames_rendered;
+        state.avg_frame_ops = total_frame_ops / frames_rendered;
+        state.avg_sgr_per_row = total_sgr_per_row / frames_rendered;
 
         fmt::format_to(std::back_inserter(to_display), "\033[0m\033[{};0H", height - 1);
-        draw_progressbar(curr_frame, total_frames, width, to_display);
+        draw_progressbar(scaled->frame_number, total_frames, width, to_display);
+        update_cost(state.render_cost, std::chrono::steady_clock::now() - start);
 
-        fmt::print(to_display);
-        to_display.clear();
+        scaled->pixels.reset(); // gives the buffer back to the pool
+        input.pop();
+        output.publish();
+    }
+    state.render_done = true;
+}
+
+void write_stage(RenderedQueue &input, PlaybackState &state, AudioPlayer &audio_player, PresentationTimer &timer, double fps) {
+    using seconds = std::chrono::duration<double>;
+    using clock = std::chrono::steady_clock;
+    const seconds frame_duration {1.0 / fps};
+    double curr_fps {};
+    double avg_fps {};
+
+    bool started {false};
+    unsigned generation {0};
+    auto generation_start = clock::now();
+    auto last_presented = generation_start;
+    // when the previous frame was due and its timestamp, frames are scheduled from these
+    // whenever the audio clock can't be used, so timing errors don't add up
+    auto last_deadline = generation_start;
+    double last_timestamp {0};
+
+    while (true) {
+        RenderedFrame *rendered = wait_for_slot([&] { return input.front(); }, state, &state.render_done);
+        if (!rendered)
+            break;
+        if (rendered->generation != state.generation) {
+            input.pop();
+            state.frames_in_flight--;
+            continue;
+        }
+
+        if (state.paused) {
+            while (state.paused && !state.quit)
+                std::this_thread::sleep_for(pause_poll_time);
+            // the old deadlines mean nothing after a pause
+            last_deadline = clock::now();
+        }
+
+        auto deadline = clock::now();
+        double lateness {0};
+        if (!started || rendered->generation != generation) {
+            // the first frame after starting or seeking is shown straight away and the sound follows it
+            audio_player.seek_to(rendered->timestamp);
+            if (!started)
+                audio_player.play();
+            started = true;
+            generation = rendered->generation;
+            generation_start = deadline;
+        } else {
+            // the video follows the sound, not the other way around
+            double delay = rendered->timestamp - audio_player.get_clock();
+            bool catching_up = deadline - generation_start < seconds {resync_timeout_seconds};
+            bool clock_usable = delay <= sync_window_seconds && (delay >= -sync_window_seconds || !catching_up);
+
+            if (!clock_usable) {
+                // keep the video's own pace until the clock is back, variable frame rate videos included
+                seconds gap {rendered->timestamp - last_timestamp};
+                if (gap <= seconds::zero() || gap > seconds {sync_window_seconds})
+                    gap = frame_duration; // a jump in the timestamps
+                deadline = std::max(last_deadline + std::chrono::duration_cast<clock::duration>(gap), deadline - std::chrono::duration_cast<clock::duration>(frame_duration));
+            } else if (delay > 0) {
+                deadline += std::chrono::duration_cast<clock::duration>(seconds {delay});
+            }
+            // late frames can't just be skipped here, the next one was rendered as a change from this one,
+            // so the DropController in the decode stage has the decoder skip frames instead
+            if (clock_usable)
+                lateness = -delay;
+            timer.wait_until(deadline);
+        }
+
+        auto write_start = clock::now();
+        if (rendered->clear_screen)
+            clear_screen();
+        write_to_terminal(rendered->to_display);
+        update_cost(state.write_cost, clock::now() - write_start);
+
+        long long curr_frame = rendered->frame_number;
+        double timestamp = rendered->timestamp;
+        input.pop();
+        state.frames_in_flight--;
+        state.lateness = lateness;
+        state.curr_frame = curr_frame;
+
+        last_deadline = deadline;
+        last_timestamp = timestamp;
+        auto now = clock::now();
+        curr_fps = 1.0 / seconds {now - last_presented}.count();
+        last_presented = now;
+        state.curr_fps = curr_fps;
 
         if (curr_frame == 1)
             avg_fps = curr_fps;
         else
             avg_fps = (avg_fps * (curr_frame - 1) + curr_fps) / curr_frame;
+        state.avg_fps = avg_fps;
+    }
+    state.quit = true;
+}
 
-        if (curr_frame % 5 == 0)
-            audio_player.seek_to(curr_frame / fps);
-
-        auto endTime = std::chrono::steady_clock::now();
-        auto elapsed_time_ns = (endTime - startTime);
-        last_elapsed_time = elapsed_time_ns;
-        auto sleep_time = next_target_frame_time - elapsed_time_ns;
-        if (sleep_time.count() > 0) {
-            curr_fps = fps;
-            auto start = std::chrono::steady_clock::now();
-            std::this_thread::sleep_for(sleep_time);
-            auto actual_sleep_time = std::chrono::steady_clock::now() - start;
-            next_target_frame_time = target_frame_time - (actual_sleep_time - sleep_time);
-        } else {
-            curr_fps = 1.0 / ((double)elapsed_time_ns.count() / nano_seconds_in_second);
-            if (fps > curr_fps)
-                frames_to_drop += fps / curr_fps;
-            if (actual_width * actual_height > 400'000)
-                frames_to_drop++;
-            next_target_frame_time = target_frame_time;
+int main(int argc, char *argv[]) {
+    auto options = parse_command_line(argc, argv);
+    const std::string &video_file = options.video_file;
+
+    std::setlocale(LC_ALL, "");
+
+    if (options.benchmark) {
+        benchmark_scaling(video_file);
+        benchmark_escape_codes();
+        return 0;
+    }
+
+#ifdef _WIN32
+    EnableVirtualTerminalProcessing();
+#endif
+
+    std::cout << "\033[?1049h"; // save current terminal content to restore later
+
+    VideoDecoder video {video_file, options.decoder_options};
+    video.set_scaling_algorithm(options.scaling_algorithm);
+
+    // plays what the decoder produces, so it has to go before the decoder does
+    AudioPlayer audio_player {video.get_audio_stream(), skip_seconds, options.audio_period_milliseconds};
+
+    double fps {video.get_fps()};
+    int seek_frames = static_cast<int>(skip_seconds * fps); // Number of frames to seek for 5 seconds
+
+    TerminalCapabilities capabilities {detect_terminal_capabilities(options.run_length)};
+
+    PlaybackState state;
+    state.audio_latency = audio_player.get_output_latency();
+    DecodedQueue decoded_frames;
+    ScaledQueue scaled_frames;
+    RenderedQueue rendered_frames;
+
+    std::thread decode_thread {decode_stage, std::ref(video), std::ref(decoded_frames), std::ref(state), fps, options.accurate_seek};
+    std::thread scale_thread {scale_stage, std::ref(video), std::ref(decoded_frames), std::ref(scaled_frames), std::ref(state)};
+    std::thread render_thread {render_stage, std::cref(video), std::ref(scaled_frames), std::ref(rendered_frames), std::ref(state), options.redraw, options.optimization_threshold, fps, capabilities, options.byte_budget, options.centre_weight};
+    PresentationTimer timer {options.spin ? presentation_spin_margin : std::chrono::nanoseconds::zero()};
+    std::thread write_thread {write_stage, std::ref(rendered_frames), std::ref(state), std::ref(audio_player), std::ref(timer), fps};
+
+    // the main thread only handles the keyboard, the stages do the actual playback
+    while (!state.quit) {
+        if (!_kbhit()) {
+            std::this_thread::sleep_for(keyboard_poll_time);
+            continue;
         }
+
+        char key = _getch();
+        if (key == ' ' || key == 'k') {
+            // pause
+            audio_player.pause();
+            state.paused = true;
+            while (true) {
+                key = _getch();
+                if (key == ' ' || key == 'k')
+                    break;
+                else if (key == 'q') {
+                    state.quit = true;
+                    break;
+                }
+            }
+            state.paused = false;
+            audio_player.play();
+        } else if (key == 'l') {
+            // seek forward
+            long long target = state.curr_frame + seek_frames;
+            long long total_frames = video.get_total_frames();
+            if (total_frames > 0)
+                target = std::min(target, total_frames - 1);
+            state.seek_target = target;
+        } else if (key == 'j') {
+            // seek backward
+            state.seek_target = std::max(state.curr_frame - seek_frames, 1ll);
+        } else if (key == 'q')
+            state.quit = true;
+        else if (key == 'r')
+            state.redraw = true;
     }
 
-    fmt::print("\033[0m"); // resets terminal color so that the user can continue with the same window
+    decode_thread.join();
+    scale_thread.join();
+    render_thread.join();
+    write_thread.join();
 
-    std::filesystem::remove_all(temp_directory);
+    fmt::print("\033[0m"); // resets terminal color so that the user can continue with the same window
 
     std::cout << "\033[?1049l"; // restore whatever was on the terminal screen before
 
-    std::cout << "Average FPS: " << avg_fps << std::endl;
+    std::cout << "Average FPS: " << state.avg_fps << std::endl;
+    std::cout << fmt::format("Rendered {:.1f} KiB per frame on average from {:.0f} drawing operations, {:.1f} colour sequences (SGR) per row",
+        state.avg_frame_bytes / 1024, state.avg_frame_ops, state.avg_sgr_per_row) << std::endl;
+    std::cout << fmt::format("Redrawn whole: {} scene cuts, {} rows", state.scene_cuts.load(), state.full_rows.load()) << std::endl;
+    JitterStats jitter = timer.get_stats();
+    std::cout << fmt::format("Frame timing: {} waits, woke up {:.1f}us late on average (std dev {:.1f}us, worst {:.1f}us)",
+        jitter.waits, jitter.mean, jitter.standard_deviation, jitter.max) << std::endl;
+    if (const AudioStream *audio = video.get_audio_stream()) {
+        std::cout << "Audio " << (audio->is_preloaded() ? "preloaded" : "streamed") << ", "
+            << audio->get_memory_usage() / 1024 << " KiB of decoded samples, ready after "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(video.get_audio_load_time()).count() << " ms" << std::endl;
+    }
+    if (const MappedFileIO *mapped_file = video.get_mapped_file()) {
+        std::cout << "Read " << mapped_file->get_bytes_read() / (1024 * 1024) << " MiB through the memory mapping, "
+            << mapped_file->get_page_faults() << " page faults waited on the disk" << std::endl;
+    }
 }
@@ -2,8 +2,21 @@
 #include <thread>
 #include <iostream>
 #include <stdexcept>
+#include "constants.h"
 
-VideoDecoder::VideoDecoder(const std::string &file_path) {
+VideoDecoder::VideoDecoder(const std::string &file_path, const DecoderOptions &options) {
+    if (options.memory_map)
+        mapped_file = MappedFileIO::open(file_path);
+    if (mapped_file) {
+        format_context = avformat_alloc_context();
+        if (!format_context) {
+            throw std::runtime_error("Could not allocate format context.");
+        }
+        format_context->pb = mapped_file->get_io_context();
+        format_context->flags |= AVFMT_FLAG_CUSTOM_IO;
+    }
+
+    // the file name is still used to guess the format when the file is memory mapped
     if (avformat_open_input(&format_context, file_path.c_str(), nullptr, nullptr) != 0) {
         throw std::runtime_error("Could not open video file.");
     }
@@ -24,6 +37,38 @@ VideoDecoder::VideoDecoder(const std::string &file_path) {
         throw std::runtime_error("No video stream found.");
     }
 
+    // timestamps in MPEG-TS and the like don't start at 0, playback counts from the first frame of the video instead
+    AVStream *video_stream = format_context->streams[video_stream_index];
+    start_pts = video_stream->start_time != AV_NOPTS_VALUE ? video_stream->start_time : 0;
+    double start_seconds = start_pts * av_q2d(video_stream->time_base);
+
+    int audio_stream_index = av_find_best_stream(format_context, AVMEDIA_TYPE_AUDIO, -1, video_stream_index, nullptr, 0);
+    if (audio_stream_index >= 0) {
+        auto start = std::chrono::steady_clock::now();
+        bool preload = options.audio_mode == AudioMode::Preload;
+        if (options.audio_mode == AudioMode::Auto && format_context->duration != AV_NOPTS_VALUE)
+            preload = format_context->duration <= static_cast<int64_t>(preload_audio_max_seconds) * AV_TIME_BASE;
+
+        // sound that can't be decoded shouldn't stop the video from playing
+        try {
+            audio_decoder = std::make_unique<AudioDecoder>(format_context, audio_stream_index, preload, start_seconds);
+            if (preload)
+                audio_decoder->preload(file_path);
+        } catch (const std::runtime_error &e) {
+            std::cerr << "Warning: playing without sound: " << e.what() << std::endl;
+            audio_decoder.reset();
+        }
+        audio_load_time = std::chrono::steady_clock::now() - start;
+    }
+
+    // the demuxer doesn't have to bother with subtitles, other audio tracks and so on
+    // (or the audio, if it has all been decoded already or can't be decoded at all)
+    for (unsigned int i = 0; i < format_context->nb_streams; i++) {
+        bool streamed_audio = audio_decoder && (int)i == audio_stream_index && !audio_decoder->is_preloaded();
+        if ((int)i != video_stream_index && !streamed_audio)
+            format_context->streams[i]->discard = AVDISCARD_ALL;
+    }
+
     codec_parameters = format_context->streams[video_stream_index]->codecpar;
     codec = avcodec_find_decoder(codec_parameters->codec_id);
     if (!codec) {
@@ -39,6 +84,23 @@ VideoDecoder::VideoDecoder(const std::string &file_path) {
         throw std::runtime_error("Could not initialize codec context.");
     }
 
+    // these only have an effect if they are set before the codec is opened
+    // 0 threads lets ffmpeg pick based on the number of cores
+    codec_context->thread_count = options.thread_count;
+    switch (options.threading) {
+    case DecoderThreading::Frame:
+        codec_context->thread_type = FF_THREAD_FRAME;
+        break;
+    case DecoderThreading::Slice:
+        codec_context->thread_type = FF_THREAD_SLICE;
+        break;
+    case DecoderThreading::LowDelay:
+        // frame threading holds back one frame per thread, which every seek has to wait for again
+        codec_context->thread_type = FF_THREAD_SLICE;
+        codec_context->flags |= AV_CODEC_FLAG_LOW_DELAY;
+        break;
+    }
+
     if (avcodec_open2(codec_context, codec, nullptr) < 0) {
         throw std::runtime_error("Could not open codec.");
     }
@@ -51,69 +113,268 @@ VideoDecoder::VideoDecoder(const std::string &file_path) {
         throw std::runtime_error("Could not allocate frame or packet.");
     }
 
-    int num_bytes = av_image_get_buffer_size(AV_PIX_FMT_RGB24, codec_context->width, codec_context->height, 1);
-    buffer.resize(num_bytes);
-
-    av_image_fill_arrays(frame_rgb->data, frame_rgb->linesize, buffer.data(), AV_PIX_FMT_RGB24, codec_context->width, codec_context->height, 1);
-
-    sws_context = sws_getContext(
-        codec_context->width, codec_context->height, codec_context->pix_fmt,
-        codec_context->width, codec_context->height, AV_PIX_FMT_RGB24,
-        SWS_BILINEAR, nullptr, nullptr, nullptr);
-
-    if (!sws_context) {
-        throw std::runtime_error("Could not initialize SwsContext.");
-    }
-
     fps = av_q2d(format_context->streams[video_stream_index]->r_frame_rate);
     total_frames = format_context->streams[video_stream_index]->nb_frames;
+    if (total_frames <= 0 && format_context->duration != AV_NOPTS_VALUE)
+        total_frames = static_cast<long long>(format_context->duration * fps / AV_TIME_BASE);
 
-    codec_context->thread_count = std::thread::hardware_concurrency();
-    codec_context->thread_type = FF_THREAD_FRAME;
+    if (auto cached_index = SeekIndex::load(file_path)) {
+        use_seek_index(std::move(*cached_index));
+    } else {
+        indexing_thread = std::thread([this, file_path] {
+            auto index = SeekIndex::build(file_path, video_stream_index, stop_indexing);
+            if (index) {
+                index->save(file_path);
+                use_seek_index(std::move(*index));
+            }
+        });
+    }
 }
 
 VideoDecoder::~VideoDecoder() {
+    stop_indexing = true;
+    if (indexing_thread.joinable())
+        indexing_thread.join();
+
     av_frame_free(&frame);
     av_frame_free(&frame_rgb);
     av_frame_free(&resized_frame);
     av_packet_free(&packet);
+    clear_queued_packets();
+    for (AVPacket *spare : spare_packets)
+        av_packet_free(&spare);
     sws_freeContext(sws_context);
     avcodec_free_context(&codec_context);
     avformat_close_input(&format_context);
 }
 
+bool VideoDecoder::decode_next_frame() {
+    while (true) {
+        // a packet can hold more than one frame and a threaded decoder holds frames back,
+        // so everything the decoder has ready is pulled before it is given another packet
+        int result = avcodec_receive_frame(codec_context, frame);
+        if (result == 0)
+            return true;
+        if (result != AVERROR(EAGAIN) || !send_next_packet())
+            return false; // AVERROR_EOF once the decoder has been drained
+    }
+}
+
+bool VideoDecoder::send_next_packet() {
+    read_audio_ahead();
+    // a corrupt packet is skipped rather than ending playback
+    if (!queued_video_packets.empty()) {
+        AVPacket *queued = queued_video_packets.front();
+        queued_video_packets.pop_front();
+        avcodec_send_packet(codec_context, queued);
+        av_packet_unref(queued);
+        spare_packets.push_back(queued);
+        return true;
+    }
+    if (read_video_packet(packet)) {
+        avcodec_send_packet(codec_context, packet);
+        av_packet_unref(packet);
+        return true;
+    }
+
+    if (draining)
+        return false;
+    // end of the file, an empty packet makes the decoder return the frames it is still holding
+    avcodec_send_packet(codec_context, nullptr);
+    draining = true;
+    return true;
+}
+
+bool VideoDecoder::read_video_packet(AVPacket *output) {
+    while (!demuxer_ended && av_read_frame(format_context, output) >= 0) {
+        if (output->stream_index == video_stream_index)
+            return true;
+        if (audio_decoder && output->stream_index == audio_decoder->get_stream_index() && !audio_decoder->is_preloaded())
+            audio_decoder->decode_packet(output);
+        av_packet_unref(output);
+    }
+
+    if (!demuxer_ended && audio_decoder && !audio_decoder->is_preloaded())
+        audio_decoder->decode_packet(nullptr);
+    demuxer_ended = true;
+    return false;
+}
+
+void VideoDecoder::read_audio_ahead() {
+    if (!audio_decoder || audio_decoder->is_preloaded())
+        return;
+
+    AudioStream &stream = audio_decoder->get_stream();
+    auto low_watermark = static_cast<ma_uint32>(stream.get_sample_rate() * audio_read_ahead_seconds);
+    while (!demuxer_ended && stream.get_buffered_frames() < low_watermark && queued_video_packets.size() < max_queued_video_packets) {
+        AVPacket *queued = nullptr;
+        if (!spare_packets.empty()) {
+            queued = spare_packets.back();
+            spare_packets.pop_back();
+        } else if (!(queued = av_packet_alloc())) {
+            return; // the audio just isn't read as far ahead
+        }
+
+        if (!read_video_packet(queued)) {
+            spare_packets.push_back(queued);
+            return;
+        }
+        queued_video_packets.push_back(queued);
+    }
+}
+
+void VideoDecoder::clear_queued_packets() {
+    for (AVPacket *queued : queued_video_packets) {
+        av_packet_unref(queued);
+        spare_packets.push_back(queued);
+    }
+    queued_video_packets.clear();
+}
+
 const AVFrame *VideoDecoder::get_next_frame() {
-    while (av_read_frame(format_context, packet) >= 0) {
-        if (packet->stream_index == video_stream_index) {
-            if (avcodec_send_packet(codec_context, packet) == 0) {
-                if (avcodec_receive_frame(codec_context, frame) == 0) {
-                    sws_scale(sws_context, frame->data, frame->linesize, 0, codec_context->height, frame_rgb->data, frame_rgb->linesize);
-                    av_packet_unref(packet);
-                    return frame_rgb;
-                }
-            }
+    if (!decode_next_frame())
+        return nullptr;
+
+    // the full resolution RGB frame is only needed by callers of this function,
+    // playback scales the decoded frame straight to the terminal size instead
+    if (!sws_context) {
+        int num_bytes = av_image_get_buffer_size(AV_PIX_FMT_RGB24, codec_context->width, codec_context->height, 1);
+        buffer.resize(num_bytes);
+
+        av_image_fill_arrays(frame_rgb->data, frame_rgb->linesize, buffer.data(), AV_PIX_FMT_RGB24, codec_context->width, codec_context->height, 1);
+
+        sws_context = sws_getContext(
+            codec_context->width, codec_context->height, codec_context->pix_fmt,
+            codec_context->width, codec_context->height, AV_PIX_FMT_RGB24,
+            SWS_BILINEAR, nullptr, nullptr, nullptr);
+
+        if (!sws_context) {
+            throw std::runtime_error("Could not initialize SwsContext.");
         }
-        av_packet_unref(packet);
     }
-    return nullptr;
+
+    sws_scale(sws_context, frame->data, frame->linesize, 0, codec_context->height, frame_rgb->data, frame_rgb->linesize);
+    return frame_rgb;
+}
+
+bool VideoDecoder::get_next_frame(AVFrame *output) {
+    av_frame_unref(output);
+    // the frame a seek landed on hasn't been handed out yet
+    if (!seeked_frame_pending && !decode_next_frame())
+        return false;
+    seeked_frame_pending = false;
+    av_frame_move_ref(output, frame);
+    return true;
+}
+
+std::optional<double> VideoDecoder::get_frame_time(const AVFrame *decoded_frame) const {
+    if (decoded_frame->best_effort_timestamp == AV_NOPTS_VALUE)
+        return std::nullopt;
+    return (decoded_frame->best_effort_timestamp - start_pts) * av_q2d(format_context->streams[video_stream_index]->time_base);
 }
 
-long double VideoDecoder::skip_to_timestamp(double timestamp_seconds) {
-    // std::cout << "Skipping to timestamp " << timestamp_seconds << " seconds." << std::endl;
-    auto time = av_rescale(timestamp_seconds * 1000, format_context->streams[video_stream_index]->time_base.den, format_context->streams[video_stream_index]->time_base.num);
-    time /= 1000;
-    if (av_seek_frame(format_context, -1, timestamp_seconds * AV_TIME_BASE, AVSEEK_FLAG_BACKWARD) < 0) {
-        throw std::runtime_error("Could not seek to the requested timestamp.");
+bool VideoDecoder::drop_frames(int count, bool catch_up) {
+    int dropped = 0;
+    if (seeked_frame_pending && dropped < count) {
+        seeked_frame_pending = false;
+        dropped++;
+    }
+
+    // none of these frames are shown, so there is no colour conversion, and nothing depends on
+    // the frames no other frame references, so they skip the loop filter
+    // when catching up they aren't decoded at all (if the codec supports it), but then they never come out
+    // of the decoder to be counted, so a whole run of B-frames goes by for every frame asked for
+    AVDiscard skip_frame = codec_context->skip_frame;
+    AVDiscard skip_loop_filter = codec_context->skip_loop_filter;
+    codec_context->skip_loop_filter = AVDISCARD_NONREF;
+    if (catch_up)
+        codec_context->skip_frame = AVDISCARD_NONREF;
+
+    // a packet isn't a frame: a threaded decoder hands back frames from earlier packets,
+    // so only the frames that actually come out and get thrown away are counted
+    // (the end of the stream only tells the decoder to drain, it doesn't count either)
+    while (dropped < count) {
+        int result = avcodec_receive_frame(codec_context, frame);
+        if (result == 0) {
+            av_frame_unref(frame);
+            dropped++;
+        } else if (result != AVERROR(EAGAIN) || !send_next_packet()) {
+            break;
+        }
+    }
+
+    codec_context->skip_frame = skip_frame;
+    codec_context->skip_loop_filter = skip_loop_filter;
+    return dropped == count;
+}
+
+long double VideoDecoder::skip_to_timestamp(double timestamp_seconds, bool accurate) {
+    AVStream *stream = format_context->streams[video_stream_index];
+    int64_t target_pts = start_pts + static_cast<int64_t>(timestamp_seconds / av_q2d(stream->time_base));
+    const KeyframeEntry *keyframe = seek_index_ready ? seek_index.find_keyframe_before(target_pts) : nullptr;
+
+    if (!keyframe || !seek_to_keyframe(*keyframe)) {
+        int64_t file_start = format_context->start_time != AV_NOPTS_VALUE ? format_context->start_time : 0;
+        if (av_seek_frame(format_context, -1, file_start + static_cast<int64_t>(timestamp_seconds * AV_TIME_BASE), AVSEEK_FLAG_BACKWARD) < 0) {
+            throw std::runtime_error("Could not seek to the requested timestamp.");
+        }
     }
     avcodec_flush_buffers(codec_context);
-    get_next_frame();
+    // everything read ahead is from before the seek
+    clear_queued_packets();
+    demuxer_ended = false;
+    // a fast seek keeps the sound from wherever the demuxer landed, its timestamps say where it belongs
+    if (audio_decoder && !audio_decoder->is_preloaded())
+        audio_decoder->flush(accurate ? timestamp_seconds : -1);
+    draining = false;
+    seeked_frame_pending = accurate ? decode_until(target_pts) : decode_next_frame();
+    // past the end of the video (total_frames can be an estimate) nothing was decoded
+    // and the frame has already been unreferenced, so its timestamp means nothing
+    if (!seeked_frame_pending || frame->best_effort_timestamp == AV_NOPTS_VALUE)
+        return timestamp_seconds;
     auto timestamp_in_seconds_that_was_actually_seeked =
-        (long double)format_context->streams[video_stream_index]->time_base.num * frame->best_effort_timestamp / format_context->streams[video_stream_index]->time_base.den;
+        (long double)stream->time_base.num * (frame->best_effort_timestamp - start_pts) / stream->time_base.den;
     return timestamp_in_seconds_that_was_actually_seeked;
 }
 
-std::pair<int, int> VideoDecoder::resize_frame(const AVFrame *input_frame, std::unique_ptr<const Pixel[]> &output_frame_data, int max_width, int max_height) {
-    double aspect_ratio = static_cast<double>(codec_context->width) / codec_context->height;
+bool VideoDecoder::decode_until(int64_t target_pts) {
+    // the frames between the keyframe and the target are never shown, so they aren't converted,
+    // and non-reference frames skip the loop filter since no later frame depends on them
+    // (skipping it on reference frames would smear artifacts into the target frame)
+    AVDiscard skip_loop_filter = codec_context->skip_loop_filter;
+    codec_context->skip_loop_filter = AVDISCARD_NONREF;
+
+    bool decoded = false;
+    while (decode_next_frame()) {
+        decoded = true;
+        int64_t pts = frame->best_effort_timestamp;
+        if (pts == AV_NOPTS_VALUE || pts >= target_pts || (frame->duration > 0 && pts + frame->duration > target_pts))
+            break;
+    }
+
+    codec_context->skip_loop_filter = skip_loop_filter;
+    return decoded;
+}
+
+bool VideoDecoder::seek_to_keyframe(const KeyframeEntry &keyframe) {
+    // going straight to the byte offset skips the demuxer's own search,
+    // which is what makes seeking slow in containers with a poor index
+    bool can_seek_bytes = keyframe.pos >= 0 && !(format_context->iformat->flags & AVFMT_NO_BYTE_SEEK);
+    if (can_seek_bytes && av_seek_frame(format_context, video_stream_index, keyframe.pos, AVSEEK_FLAG_BYTE) >= 0)
+        return true;
+    // the exact timestamp of a keyframe still lands on it, unlike a guess between keyframes
+    return av_seek_frame(format_context, video_stream_index, keyframe.pts, AVSEEK_FLAG_BACKWARD) >= 0;
+}
+
+void VideoDecoder::use_seek_index(SeekIndex &&index) {
+    seek_index = std::move(index);
+    if (seek_index.get_total_frames() > 0)
+        total_frames = seek_index.get_total_frames();
+    seek_index_ready = true;
+}
+
+std::pair<int, int> VideoDecoder::resize_frame(const AVFrame *input_frame, PixelBuffer &output_frame_data, int max_width, int max_height) {
+    double aspect_ratio = static_cast<double>(input_frame->width) / input_frame->height;
     int new_width = max_width;
     int new_height = max_height;
 
@@ -123,28 +384,23 @@ std::pair<int, int> VideoDecoder::resize_frame(const AVFrame *input_frame, std::
         new_width = static_cast<int>(max_height * aspect_ratio);
     }
 
-    SwsContext *resize_context = sws_getContext(
-        codec_context->width, codec_context->height, AV_PIX_FMT_RGB24,
+    // converting from the decoder's pixel format and resizing in the same pass
+    // means the full resolution frame is never converted to RGB
+    SwsContext *resize_context = resize_contexts.get({
+        input_frame->width, input_frame->height, static_cast<AVPixelFormat>(input_frame->format),
         new_width, new_height, AV_PIX_FMT_RGB24,
-        SWS_BICUBIC, nullptr, nullptr, nullptr);
-
-    if (!resize_context) {
-        throw std::runtime_error("Could not initialize resize SwsContext.");
-    }
+        to_sws_flags(scaling_algorithm)});
 
     int num_bytes = av_image_get_buffer_size(AV_PIX_FMT_RGB24, new_width, new_height, 1);
-    auto data = std::unique_ptr<uint8_t[]>(new uint8_t[num_bytes]);
-    av_image_fill_arrays(resized_frame->data, resized_frame->linesize, data.get(), AV_PIX_FMT_RGB24, new_width, new_height, 1);
-
-    output_frame_data = std::unique_ptr<Pixel[]>(reinterpret_cast<Pixel *>(data.release()));
+    output_frame_data = frame_pool.get(num_bytes);
+    av_image_fill_arrays(resized_frame->data, resized_frame->linesize, reinterpret_cast<uint8_t *>(output_frame_data.get()), AV_PIX_FMT_RGB24, new_width, new_height, 1);
 
     sws_scale(
         resize_context,
-        &input_frame->data[0], &input_frame->linesize[0], 0, codec_context->height,
+        input_frame->data, input_frame->linesize, 0, input_frame->height,
         resized_frame->data, resized_frame->linesize);
 
     resized_frame->data[0] = nullptr; // to ensure that ffmpeg doesn't free the output data
-    sws_freeContext(resize_context);
 
     return {new_width, new_height};
 }
@@ -1,8 +1,20 @@
 #pragma once
 #include <string>
+#include <string_view>
+#include <array>
+#include <deque>
 #include <vector>
 #include "Pixel.h"
 #include <memory>
+#include <optional>
+#include "ScalerCache.h"
+#include "FramePool.h"
+#include "SeekIndex.h"
+#include "MappedFileIO.h"
+#include "AudioDecoder.h"
+#include <atomic>
+#include <chrono>
+#include <thread>
 
 extern "C" {
 #include <libavformat/avformat.h>
@@ -11,18 +23,62 @@ extern "C" {
 #include <libavutil/imgutils.h>
 }
 
+enum class DecoderThreading {
+    // fastest playback, but every thread adds a frame of delay
+    Frame,
+    Slice,
+    // slice threading with low delay decoding, for when seeking a lot
+    LowDelay
+};
+
+// names used on the command line
+constexpr std::array<std::pair<std::string_view, DecoderThreading>, 3> decoder_threading_modes {{
+    {"frame", DecoderThreading::Frame},
+    {"slice", DecoderThreading::Slice},
+    {"low-delay", DecoderThreading::LowDelay},
+}};
+
+struct DecoderOptions {
+    DecoderThreading threading = DecoderThreading::Frame;
+    // 0 picks based on the number of cores
+    int thread_count = 0;
+    // read local files through a memory mapping with readahead instead of ffmpeg's own file reading
+    bool memory_map = true;
+    AudioMode audio_mode = AudioMode::Auto;
+};
+
 class VideoDecoder {
 public:
-    VideoDecoder(const std::string &file_path);
+    VideoDecoder(const std::string &file_path, const DecoderOptions &options = {});
     ~VideoDecoder();
 
-    // if heap_allocate is true, the frame data will be allocated on the heap
-    // and the caller is reponsible to free it
-    // otherwise just return a raw pointer to the internal ffmpeg data
-    // in which case the caller should not free the memory
+    // returns the next frame converted to full resolution RGB24
+    // the frame belongs to the decoder and is overwritten by the next call
     const AVFrame *get_next_frame();
-    long double skip_to_timestamp(double timestamp_seconds);
-    std::pair<int, int> resize_frame(const AVFrame *input_frame, std::unique_ptr<const Pixel[]> &output_frame_data, int max_width, int max_height);
+    // moves the next decoded frame into output in the decoder's own pixel format (usually YUV)
+    // without converting it to RGB, pass it to resize_frame to get something displayable
+    // returns false when there are no more frames
+    bool get_next_frame(AVFrame *output);
+    // skips the next count frames because they won't be displayed, doing as little decoding as possible
+    // catch_up also lets the decoder leave out frames nothing references, which aren't counted,
+    // so more than count can go by and the timestamp of the next frame says where playback really is
+    // returns false if the video ended first
+    bool drop_frames(int count, bool catch_up);
+    // uses the seek index once it is ready, before that it lets the demuxer find the position
+    // if accurate is true it decodes forward from the keyframe to the frame showing timestamp_seconds,
+    // otherwise it stops at the keyframe
+    // returns the exact timestamp of the frame it landed on, which the next get_next_frame(AVFrame *) returns
+    // or timestamp_seconds if there was no frame to land on
+    long double skip_to_timestamp(double timestamp_seconds, bool accurate);
+    // when a frame from get_next_frame(AVFrame *) should be shown, in seconds from the start of the video, if the file says so
+    std::optional<double> get_frame_time(const AVFrame *decoded_frame) const;
+    // input_frame can be in any pixel format, the output is always RGB24 Pixels
+    // output_frame_data is replaced with a buffer from the decoder's FramePool
+    std::pair<int, int> resize_frame(const AVFrame *input_frame, PixelBuffer &output_frame_data, int max_width, int max_height);
+
+    inline void set_scaling_algorithm(ScalingAlgorithm algorithm) {
+        scaling_algorithm = algorithm;
+    }
 
     inline int get_width() const {
         return codec_context->width;
@@ -33,10 +89,44 @@ public:
     inline double get_fps() const {
         return fps;
     }
+    // an estimate until the seek index is ready, then the exact count
+    // safe to call from any thread
     inline long long get_total_frames() const {
         return total_frames;
     }
+    // nullptr if the file has no sound or it can't be decoded
+    // the audio is decoded along with the video, as the packets come out of the file, and read a little ahead of it
+    inline AudioStream *get_audio_stream() const {
+        return audio_decoder ? &audio_decoder->get_stream() : nullptr;
+    }
+    // how long opening the audio took, including decoding all of it if it was preloaded
+    inline std::chrono::nanoseconds get_audio_load_time() const {
+        return audio_load_time;
+    }
+    // nullptr if the file isn't memory mapped
+    inline const MappedFileIO *get_mapped_file() const {
+        return mapped_file.get();
+    }
 private:
+    bool decode_next_frame();
+    // sends the next video packet, or the end of stream to the decoder
+    // audio packets read on the way go to the audio decoder
+    // returns false if there is nothing left to send
+    bool send_next_packet();
+    // reads from the file until output holds a video packet, decoding the audio packets on the way
+    // returns false at the end of the file, once the audio decoder has been told to drain
+    bool read_video_packet(AVPacket *output);
+    // streamed audio is only decoded as packets are read, so reading just what the video needs keeps
+    // the sound as little ahead as the pipeline is deep, this keeps reading until enough is buffered
+    // and queues the video packets it comes across
+    void read_audio_ahead();
+    void clear_queued_packets();
+    bool seek_to_keyframe(const KeyframeEntry &keyframe);
+    // decodes without converting until the frame that covers target_pts
+    bool decode_until(int64_t target_pts);
+    void use_seek_index(SeekIndex &&index);
+
+    std::unique_ptr<MappedFileIO> mapped_file;
     AVFormatContext *format_context = nullptr;
     AVCodecContext *codec_context = nullptr;
     AVCodecParameters *codec_parameters = nullptr;
@@ -46,9 +136,32 @@ private:
     AVFrame *frame = nullptr;
     AVFrame *frame_rgb = nullptr;
     SwsContext *sws_context = nullptr;
+    ScalerCache resize_contexts;
+    FramePool frame_pool;
+    std::unique_ptr<AudioDecoder> audio_decoder;
+    std::chrono::nanoseconds audio_load_time {0};
+    ScalingAlgorithm scaling_algorithm = ScalingAlgorithm::Bicubic;
     int video_stream_index;
+    // the video stream's first timestamp, every time in seconds is counted from it
+    int64_t start_pts {0};
+    bool seeked_frame_pending = false;
+    // the end of the stream was sent to the decoder
+    bool draining = false;
+    // the end of the file was read, there can still be video packets in the queue
+    bool demuxer_ended = false;
+    // read ahead of the decoder for the audio's sake, oldest first
+    std::deque<AVPacket *> queued_video_packets;
+    // emptied packets, so the queue doesn't allocate once it has been full
+    std::vector<AVPacket *> spare_packets;
+    // only allocated once get_next_frame() is called
     std::vector<uint8_t> buffer;
     double fps;
-    long long total_frames;
+    std::atomic<long long> total_frames;
+
+    // built on a background thread the first time a file is opened, then loaded from the cache
+    SeekIndex seek_index;
+    std::atomic<bool> seek_index_ready {false};
+    std::atomic<bool> stop_indexing {false};
+    std::thread indexing_thread;
 };
 
@@ -0,0 +1,104 @@
+#include "benchmark.h"
+#include <array>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <fmt/core.h>
+#include "VideoDecoder.h"
+#include "Pipeline.h"
+#include "utils.h"
+
+// sizes in pixels, so a terminal with half as many rows
+constexpr std::array<std::pair<int, int>, 3> benchmark_sizes {{{80, 48}, {200, 100}, {400, 200}}};
+constexpr int benchmark_frames = 8;
+constexpr int benchmark_iterations = 200;
+// about one 300x80 frame where every cell changes both colours
+constexpr int benchmark_sequences = 48'000;
+constexpr int benchmark_sequence_rounds = 50;
+
+void benchmark_scaling(const std::string &video_file) {
+    // the sound is never played here, so it isn't decoded up front either
+    DecoderOptions options;
+    options.audio_mode = AudioMode::Stream;
+    VideoDecoder video {video_file, options};
+
+    std::array<DecodedFrame, benchmark_frames> frames;
+    int decoded_frames = 0;
+    for (auto &decoded : frames) {
+        if (!video.get_next_frame(decoded.frame))
+            break;
+        decoded_frames++;
+    }
+    if (decoded_frames == 0) {
+        throw std::runtime_error("Could not decode any frames to benchmark.");
+    }
+
+    fmt::print("Resizing {}x{} frames, {} iterations each\n", video.get_width(), video.get_height(), benchmark_iterations);
+
+    PixelBuffer output;
+    for (auto [width, height] : benchmark_sizes) {
+        for (auto [name, algorithm] : scaling_algorithms) {
+            video.set_scaling_algorithm(algorithm);
+
+            // the first frame also pays for creating the SwsContext
+            auto start = std::chrono::steady_clock::now();
+            video.resize_frame(frames[0].frame, output, width, height);
+            std::chrono::nanoseconds first_frame_time = std::chrono::steady_clock::now() - start;
+
+            start = std::chrono::steady_clock::now();
+            for (int i = 0; i < benchmark_iterations; ++i)
+                video.resize_frame(frames[i % decoded_frames].frame, output, width, height);
+            std::chrono::nanoseconds total_time = std::chrono::steady_clock::now() - start;
+
+            fmt::print(
+                "{:>4}x{:<4} {:<14} first frame {:>10} ns {:>10} ns/frame\n",
+                width, height, name, first_frame_time.count(), total_time.count() / benchmark_iterations
+            );
+        }
+    }
+}
+
+// how set_color and set_cursor used to write the sequences
+static void fmt_set_color(Pixel p, bool bg, std::string &result) {
+    fmt::format_to(std::back_inserter(result), "{}[{};2;{};{};{}m", esc, bg ? 48 : 38, p.r, p.g, p.b);
+}
+
+static void fmt_set_cursor(size_t x, size_t y, std::string &result) {
+    fmt::format_to(std::back_inserter(result), "{}[{};{}H", esc, y, x + 1);
+}
+
+template <typename SetColor, typename SetCursor>
+static std::chrono::nanoseconds time_escape_codes(const std::vector<Pixel> &colors, std::string &output, SetColor set_color, SetCursor set_cursor) {
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < benchmark_sequence_rounds; ++round) {
+        output.clear();
+        for (size_t i = 0; i < colors.size(); ++i) {
+            set_color(colors[i], i % 2 == 0, output);
+            // a cursor move for every 8 colours, roughly what a diffed frame has
+            if (i % 8 == 0)
+                set_cursor(i % 320, i / 320 % 100 + 2, output);
+        }
+    }
+    return std::chrono::steady_clock::now() - start;
+}
+
+void benchmark_escape_codes() {
+    // a fixed pattern rather than random colours, so every run measures the same thing
+    std::vector<Pixel> colors(benchmark_sequences);
+    for (size_t i = 0; i < colors.size(); ++i)
+        colors[i] = Pixel(static_cast<uint8_t>(i * 7), static_cast<uint8_t>(i * 13 / 5), static_cast<uint8_t>(i * 31 / 17));
+
+    std::string fmt_output;
+    std::string table_output;
+    std::chrono::nanoseconds fmt_time = time_escape_codes(colors, fmt_output, fmt_set_color, fmt_set_cursor);
+    std::chrono::nanoseconds table_time = time_escape_codes(colors, table_output, set_color, set_cursor);
+    if (fmt_output != table_output) {
+        throw std::runtime_error("The escape code encoders wrote different output.");
+    }
+
+    double sequences = static_cast<double>(benchmark_sequences + benchmark_sequences / 8) * benchmark_sequence_rounds;
+    fmt::print("\nWriting {} escape sequences, {} rounds\n", benchmark_sequences + benchmark_sequences / 8, benchmark_sequence_rounds);
+    fmt::print("fmt::format_to {:>8.1f} ns/sequence\n", fmt_time.count() / sequences);
+    fmt::print("lookup table   {:>8.1f} ns/sequence ({:.1f}x)\n", table_time.count() / sequences, static_cast<double>(fmt_time.count()) / table_time.count());
+}
@@ -0,0 +1,9 @@
+#pragma once
+#include <string>
+
+// decodes a few frames of video_file and prints how long resizing them
+// to a few terminal sizes takes with every scaling algorithm
+void benchmark_scaling(const std::string &video_file);
+
+// prints how long writing colour and cursor escape sequences takes with fmt and with the lookup table encoder
+void benchmark_escape_codes();
@@ -1,6 +1,7 @@
 #include "commandline.h"
 #include <iostream>
 #include "constants.h"
+#include <algorithm>
 
 void print_help() {
     std::cout << "Usage: TerminalVideoPlayer.exe [options] <video_file>" << std::endl;
@@ -12,6 +13,26 @@ void print_help() {
     std::cout << "  -r, --redraw\t\t\tForce redraw of the entire frame instead of optimizing and only updating pixels that need updating" << std::endl;
     std::cout << "              \t\t\tDefault is false, should only be used if you hate artifacts, love slow powerpoint presentations," << std::endl;
     std::cout << "              \t\t\tor if your terminal font size is somewhat big" << std::endl;
+    std::cout << "  -s, --scaling\t\t\tAlgorithm used to resize frames to the terminal size" << std::endl;
+    std::cout << "               \t\t\tone of fast-bilinear, area, bicubic or lanczos, default is bicubic" << std::endl;
+    std::cout << "  -t, --threads\t\t\tNumber of threads used to decode the video, default is 0 which picks based on the number of cores" << std::endl;
+    std::cout << "  -m, --thread-mode\t\tHow decoding is split between threads, one of frame, slice or low-delay, default is frame" << std::endl;
+    std::cout << "                   \t\tlow-delay is slice threading without any frames held back, useful if you seek a lot" << std::endl;
+    std::cout << "  --no-mmap\t\t\tLet ffmpeg read the file itself instead of memory mapping it" << std::endl;
+    std::cout << "  -a, --audio\t\t\tHow the sound is decoded, one of auto, stream or preload, default is auto" << std::endl;
+    std::cout << "             \t\t\tstream decodes it as the video plays, preload decodes all of it before playback starts," << std::endl;
+    std::cout << "             \t\t\tauto preloads videos up to " << preload_audio_max_seconds << " seconds long and streams longer ones" << std::endl;
+    std::cout << "  -p, --audio-period\t\tMilliseconds of sound the audio device asks for at once, default is 0 which lets miniaudio pick" << std::endl;
+    std::cout << "                    \t\tsmaller values keep the sound closer to the picture but can make it crackle" << std::endl;
+    std::cout << "  --no-spin\t\t\tOnly sleep until a frame is due, uses less CPU but frames come out less evenly" << std::endl;
+    std::cout << "  --run-length\t\t\tWrite runs of identical cells with REP and ECH, one of auto, on or off, default is auto" << std::endl;
+    std::cout << "              \t\t\tauto only uses them in terminals known to support them, on can garble the picture in others" << std::endl;
+    std::cout << "  --byte-budget\t\t\tKiB each frame's picture may take, default is 0 which doesn't limit it" << std::endl;
+    std::cout << "               \t\t\tthe cells that changed the most are drawn first and the rest catch up over the next frames" << std::endl;
+    std::cout << "  --centre-weight\t\tHow much more changes in the middle of the picture count with --byte-budget, default is " << default_centre_weight << std::endl;
+    std::cout << "                 \t\t0 treats the whole picture the same" << std::endl;
+    std::cout << "  -f, --fast-seek\t\tSeek to the nearest keyframe instead of the exact frame, faster but less accurate" << std::endl;
+    std::cout << "  -b, --benchmark\t\tPrint how long resizing frames (with each scaling algorithm) and writing escape codes take, and exit" << std::endl;
     std::cout << "\nVideo Controls:" << std::endl;
     std::cout << "  q\t\t\tQuit" << std::endl;
     std::cout << "  r\t\t\tRedraw the entire frame, use if you want to get rid of artifacts" << std::endl;
@@ -20,14 +41,12 @@ void print_help() {
     std::cout << "  k\t\t\tSkip forward 5 seconds" << std::endl;
 }
 
-std::tuple<bool, double, std::string> parse_command_line(int argc, char *argv[]) {
+CommandLineOptions parse_command_line(int argc, char *argv[]) {
     if (argc < 2) {
         print_help();
         exit(1);
     }
-    bool redraw = false;
-    double optimization_threshold = default_optimization_threshold;
-    std::string video_file;
+    CommandLineOptions options;
     for (int i = 1; i < argc; ++i) {
         std::string arg = argv[i];
         if (arg == "-h" || arg == "--help") {
@@ -35,8 +54,8 @@ std::tuple<bool, double, std::string> parse_command_line(int argc, char *argv[])
             exit(0);
         } else if (arg == "-o" || arg == "--optimization-level") {
             if (i + 1 < argc) {
-                optimization_threshold = std::stod(argv[i + 1]);
-                if (optimization_threshold < 0) {
+                options.optimization_threshold = std::stod(argv[i + 1]);
+                if (options.optimization_threshold < 0) {
                     std::cerr << "Error: optimization threshold must be a positive number" << std::endl;
                     exit(1);
                 }
@@ -46,14 +65,135 @@ std::tuple<bool, double, std::string> parse_command_line(int argc, char *argv[])
                 exit(1);
             }
         } else if (arg == "-r" || arg == "--redraw") {
-            redraw = true;
+            options.redraw = true;
+        } else if (arg == "-s" || arg == "--scaling") {
+            if (i + 1 < argc) {
+                std::string name = argv[i + 1];
+                auto algorithm = std::find_if(scaling_algorithms.begin(), scaling_algorithms.end(), [&name](const auto &entry) {
+                    return entry.first == name;
+                });
+                if (algorithm == scaling_algorithms.end()) {
+                    std::cerr << "Error: unknown scaling algorithm " << name << std::endl;
+                    exit(1);
+                }
+                options.scaling_algorithm = algorithm->second;
+                i++;
+            } else {
+                std::cerr << "Error: -s requires an argument" << std::endl;
+                exit(1);
+            }
+        } else if (arg == "-t" || arg == "--threads") {
+            if (i + 1 < argc) {
+                options.decoder_options.thread_count = std::stoi(argv[i + 1]);
+                if (options.decoder_options.thread_count < 0) {
+                    std::cerr << "Error: thread count must be a positive number" << std::endl;
+                    exit(1);
+                }
+                i++;
+            } else {
+                std::cerr << "Error: -t requires an argument" << std::endl;
+                exit(1);
+            }
+        } else if (arg == "-m" || arg == "--thread-mode") {
+            if (i + 1 < argc) {
+                std::string name = argv[i + 1];
+                auto mode = std::find_if(decoder_threading_modes.begin(), decoder_threading_modes.end(), [&name](const auto &entry) {
+                    return entry.first == name;
+                });
+                if (mode == decoder_threading_modes.end()) {
+                    std::cerr << "Error: unknown thread mode " << name << std::endl;
+                    exit(1);
+                }
+                options.decoder_options.threading = mode->second;
+                i++;
+            } else {
+                std::cerr << "Error: -m requires an argument" << std::endl;
+                exit(1);
+            }
+        } else if (arg == "--no-mmap") {
+            options.decoder_options.memory_map = false;
+        } else if (arg == "-a" || arg == "--audio") {
+            if (i + 1 < argc) {
+                std::string name = argv[i + 1];
+                auto mode = std::find_if(audio_modes.begin(), audio_modes.end(), [&name](const auto &entry) {
+                    return entry.first == name;
+                });
+                if (mode == audio_modes.end()) {
+                    std::cerr << "Error: unknown audio mode " << name << std::endl;
+                    exit(1);
+                }
+                options.decoder_options.audio_mode = mode->second;
+                i++;
+            } else {
+                std::cerr << "Error: -a requires an argument" << std::endl;
+                exit(1);
+            }
+        } else if (arg == "-p" || arg == "--audio-period") {
+            if (i + 1 < argc) {
+                int period = std::stoi(argv[i + 1]);
+                if (period < 0) {
+                    std::cerr << "Error: audio period must be a positive number" << std::endl;
+                    exit(1);
+                }
+                options.audio_period_milliseconds = period;
+                i++;
+            } else {
+                std::cerr << "Error: -p requires an argument" << std::endl;
+                exit(1);
+            }
+        } else if (arg == "--no-spin") {
+            options.spin = false;
+        } else if (arg == "--run-length") {
+            if (i + 1 < argc) {
+                std::string name = argv[i + 1];
+                auto mode = std::find_if(run_length_modes.begin(), run_length_modes.end(), [&name](const auto &entry) {
+                    return entry.first == name;
+                });
+                if (mode == run_length_modes.end()) {
+                    std::cerr << "Error: unknown run length mode " << name << std::endl;
+                    exit(1);
+                }
+                options.run_length = mode->second;
+                i++;
+            } else {
+                std::cerr << "Error: --run-length requires an argument" << std::endl;
+                exit(1);
+            }
+        } else if (arg == "--byte-budget") {
+            if (i + 1 < argc) {
+                options.byte_budget = std::stod(argv[i + 1]) * 1024;
+                if (options.byte_budget < 0) {
+                    std::cerr << "Error: byte budget must be a positive number" << std::endl;
+                    exit(1);
+                }
+                i++;
+            } else {
+                std::cerr << "Error: --byte-budget requires an argument" << std::endl;
+                exit(1);
+            }
+        } else if (arg == "--centre-weight") {
+            if (i + 1 < argc) {
+                options.centre_weight = std::stod(argv[i + 1]);
+                if (options.centre_weight < 0) {
+                    std::cerr << "Error: centre weight must be a positive number" << std::endl;
+                    exit(1);
+                }
+                i++;
+            } else {
+                std::cerr << "Error: --centre-weight requires an argument" << std::endl;
+                exit(1);
+            }
+        } else if (arg == "-f" || arg == "--fast-seek") {
+            options.accurate_seek = false;
+        } else if (arg == "-b" || arg == "--benchmark") {
+            options.benchmark = true;
         } else {
-            video_file = arg;
+            options.video_file = arg;
         }
     }
-    if (video_file.empty()) {
+    if (options.video_file.empty()) {
         std::cerr << "Error: no video file specified" << std::endl;
         exit(1);
     }
-    return {redraw, optimization_threshold, video_file};
+    return options;
 }
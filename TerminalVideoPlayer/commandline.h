@@ -1,7 +1,30 @@
 #pragma once
 #include <string>
-#include <tuple>
+#include "constants.h"
+#include "ScalerCache.h"
+#include "VideoDecoder.h"
+#include "TerminalCapabilities.h"
+
+struct CommandLineOptions {
+    bool redraw = false;
+    double optimization_threshold = default_optimization_threshold;
+    ScalingAlgorithm scaling_algorithm = ScalingAlgorithm::Bicubic;
+    // decode forward from the keyframe to the exact frame when seeking
+    bool accurate_seek = true;
+    DecoderOptions decoder_options;
+    // spin for the last moment before a frame is due instead of trusting the OS timer with it
+    bool spin = true;
+    // size of the audio device's period, 0 leaves it to miniaudio
+    unsigned audio_period_milliseconds = 0;
+    // whether runs of identical cells are written with REP and ECH
+    RunLengthMode run_length = RunLengthMode::Auto;
+    // bytes the picture of a frame may take, 0 for no limit
+    double byte_budget = 0;
+    double centre_weight = default_centre_weight;
+    // time the scaling algorithms on the video instead of playing it
+    bool benchmark = false;
+    std::string video_file;
+};
 
 void print_help();
-// return tuple of <redraw, optimization_threshold, video_file>
-std::tuple<bool, double, std::string> parse_command_line(int argc, char *argv[]);
+CommandLineOptions parse_command_line(int argc, char *argv[]);
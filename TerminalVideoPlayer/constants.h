@@ -3,21 +3,81 @@
 #include <vector>
 #include "Pixel.h"
 #include <array>
+#include <chrono>
 
 const char esc = '\x1B';
 
 constexpr const char *block = u8"\u2584"; // ? character
+constexpr size_t block_length = std::char_traits<char>::length(block);
 constexpr double default_optimization_threshold = 25.0;
 
-constexpr std::string_view audio_file_name = "output_audio.wav";
+// how much decoded audio can wait for the audio device
+constexpr unsigned audio_ring_buffer_seconds = 4;
+// streamed audio is demuxed ahead of the video until this much is buffered, so a stall in the pipeline shorter
+// than that doesn't starve the audio device, it has to stay well under audio_ring_buffer_seconds
+constexpr double audio_read_ahead_seconds = 2;
+// the video packets read on the way are held until the decoder wants them, this caps their number
+// in case the audio is interleaved very coarsely or ends long before the video
+constexpr size_t max_queued_video_packets = 256;
+// longer soundtracks are streamed by default, 2 minutes of 48kHz stereo is about 46 MiB once decoded
+constexpr int preload_audio_max_seconds = 120;
+
+constexpr std::string_view seek_index_directory_name = "TerminalVideoPlayer";
+constexpr std::string_view seek_index_extension = ".index";
+// first line of every seek index file, change it whenever the format changes
+constexpr std::string_view seek_index_header = "TerminalVideoPlayer seek index 1";
+// an index is saved under a temporary name ending in this and renamed once it is complete
+constexpr std::string_view seek_index_temp_extension = ".tmp";
+// the shortest line a keyframe can take up in an index file, "0 0 0\n"
+constexpr size_t min_seek_index_entry_size = 6;
+
+// how far ahead of the playback position the OS is asked to read a memory mapped file
+constexpr size_t readahead_window_bytes = 8 * 1024 * 1024;
+constexpr int mapped_io_buffer_size = 64 * 1024;
+
+// a frame further than this from the audio clock means the clock isn't following the video,
+// either the sound hasn't caught up with a seek yet or it has ended
+constexpr double sync_window_seconds = 0.5;
+// how long after a seek a clock that is ahead of the video is still assumed to be catching up
+constexpr double resync_timeout_seconds = 1.0;
+
+// how the DropController reacts, see DropController.cpp
+// each new measurement of a stage's cost makes up this much of its average
+constexpr double cost_smoothing = 0.1;
+// stages are planned as if they took this much longer than measured, so they don't run flat out
+constexpr double drop_cost_headroom = 1.15;
+constexpr double min_shown_fraction = 0.1;
+constexpr double drop_correction_decrease = 0.97;
+constexpr double drop_correction_increase = 0.01;
+// frames behind the sound after which a stretch is skipped at once instead of showing fewer frames
+constexpr double catch_up_threshold_frames = 4;
+
+// the part of every wait before a frame is due that is spun instead of slept
+constexpr std::chrono::microseconds presentation_spin_margin {500};
+
+// what the render stage assumes a drawn cell and a cursor move cost in bytes, until it has measured them
+constexpr double default_cell_bytes = 10;
+constexpr double default_move_bytes = 6;
+// how much more the error in the middle of the picture counts than at its edges with --byte-budget, 1 is twice as much
+constexpr double default_centre_weight = 1.0;
+// a keyframe where at least this fraction of the cells changed is taken as a scene cut and redrawn whole
+constexpr double scene_cut_changed_fraction = 0.5;
+
+// rows of a ScreenBuffer start on a multiple of this many cells, 16 cells of 4 bytes are a cache line
+constexpr size_t screen_row_alignment = 16;
 
 constexpr int skip_seconds = 5;
 constexpr long long nano_seconds_in_second = 1'000'000'000;
 
+// how the pipeline stages wait on each other, see wait_for_slot
+constexpr int wait_spin_attempts = 64;
+constexpr std::chrono::microseconds wait_backoff_time {200};
+constexpr std::chrono::milliseconds pause_poll_time {10};
+constexpr std::chrono::milliseconds keyboard_poll_time {10};
+
 constexpr std::array<std::string_view, 8> block_chars {
     u8" ", u8"\u258F", u8"\u258E", u8"\u258D", u8"\u258C", u8"\u258B", u8"\u258A", u8"\u2589"
 };
 
 constexpr const char *full_block = u8"\u2588";
-
-typedef std::vector<std::vector<TerminalPixel>> Frame;
+constexpr const char *upper_block = u8"\u2580";
@@ -1,48 +1,18 @@
 #include "utils.h"
 #include <math.h>
-#include <sstream>
 #include <iostream>
 #include <stdlib.h>
+#include <cstdio>
 #include <fmt/core.h>
 #include <algorithm>
-
-double distance(Pixel p1, Pixel p2) {
-    short r = (short)p1.r - (short)p2.r;
-    short g = (short)p1.g - (short)p2.g;
-    short b = (short)p1.b - (short)p2.b;
-    return std::sqrt((r * r) + (g * g) + (b * b));
-}
-
-// taken from https://stackoverflow.com/a/58454949/19581763
-std::filesystem::path create_temp_directory(unsigned long long max_tries) {
-    auto tmp_dir = std::filesystem::temp_directory_path();
-    unsigned long long i = 0;
-    std::random_device dev;
-    std::mt19937 prng(dev());
-    std::uniform_int_distribution<uint64_t> rand(0);
-    std::filesystem::path path;
-    while (true) {
-        std::stringstream ss;
-        ss << std::hex << rand(prng);
-        path = tmp_dir / ss.str();
-        // true if the directory was created.
-        if (std::filesystem::create_directory(path)) {
-            break;
-        }
-        if (i == max_tries) {
-            throw std::runtime_error("could not find non-existing directory");
-        }
-        i++;
-    }
-    return path;
-}
+#include "EscapeEncoder.h"
 
 void set_cursor(size_t x, size_t y, std::string &result) {
-    fmt::format_to(std::back_inserter(result), "{}[{};{}H", esc, y, x + 1);
+    append_sequence(result, max_cursor_sequence_length, [&](char *out) { return encode_cursor(out, x, y); });
 }
 
 void set_color(Pixel p, bool bg, std::string &result) {
-    fmt::format_to(std::back_inserter(result), "{}[{};2;{};{};{}m", esc, bg ? 48 : 38, p.r, p.g, p.b);
+    append_sequence(result, max_color_sequence_length, [&](char *out) { return encode_color(out, p, bg); });
 }
 
 void clear_screen() {
@@ -52,3 +22,13 @@ void clear_screen() {
     system("clear");
 #endif
 }
+
+void write_to_terminal(std::string_view text) {
+#ifdef _WIN32
+    // fmt converts to UTF-16 for the windows console, otherwise the block characters come out garbled
+    fmt::print("{}", text);
+#else
+    std::fwrite(text.data(), 1, text.size(), stdout);
+    std::fflush(stdout);
+#endif
+}